@@ -11,6 +11,14 @@
 
 #include "..\cpuid\cpuid.h"
 
+#if defined(HAVE_GETCPUID)
+// sha256_sse41.cpp, sha256_avx2.cpp and sha256_shani.cpp pick their instruction set with
+// target pragmas, so they are always built on x86 and only selected after the CPUID checks below.
+#define ENABLE_SSE41 1
+#define ENABLE_AVX2 1
+#define ENABLE_SHANI 1
+#endif
+
 #if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
 #if defined(USE_ASM)
 namespace sha256_sse4
@@ -25,11 +33,21 @@ namespace sha256d64_sse41
 void Transform_4way(unsigned char* out, const unsigned char* in);
 }
 
+namespace sha256_sse41
+{
+void Chain32_4way(uint32_t* words, size_t stride, uint32_t iters);
+}
+
 namespace sha256d64_avx2
 {
 void Transform_8way(unsigned char* out, const unsigned char* in);
 }
 
+namespace sha256_avx2
+{
+void Chain32_8way(uint32_t* words, size_t stride, uint32_t iters);
+}
+
 namespace sha256d64_shani
 {
 void Transform_2way(unsigned char* out, const unsigned char* in);
@@ -38,6 +56,8 @@ void Transform_2way(unsigned char* out, const unsigned char* in);
 namespace sha256_shani
 {
 void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+void Chain32(uint32_t* s, uint32_t iters);
+void Chain32_2way(uint32_t* words, size_t stride, uint32_t iters);
 }
 
 // Internal implementation code.
@@ -413,10 +433,216 @@ void TransformD64(unsigned char* out, const unsigned char* in)
     WriteBE32(out + 28, h + 0x5be0cd19ul);
 }
 
+/** Hash a 32-byte message given as 8 words in place, iters times. W8..W15 are the constant padding. */
+void TransformChain32(uint32_t* s, uint32_t iters)
+{
+    uint32_t w0 = s[0], w1 = s[1], w2 = s[2], w3 = s[3], w4 = s[4], w5 = s[5], w6 = s[6], w7 = s[7];
+    while (iters--) {
+        uint32_t a = 0x6a09e667ul;
+        uint32_t b = 0xbb67ae85ul;
+        uint32_t c = 0x3c6ef372ul;
+        uint32_t d = 0xa54ff53aul;
+        uint32_t e = 0x510e527ful;
+        uint32_t f = 0x9b05688cul;
+        uint32_t g = 0x1f83d9abul;
+        uint32_t h = 0x5be0cd19ul;
+        uint32_t w8, w9, w10, w11, w12, w13, w14, w15;
+
+        Round(a, b, c, d, e, f, g, h, 0x428a2f98ul + w0);
+        Round(h, a, b, c, d, e, f, g, 0x71374491ul + w1);
+        Round(g, h, a, b, c, d, e, f, 0xb5c0fbcful + w2);
+        Round(f, g, h, a, b, c, d, e, 0xe9b5dba5ul + w3);
+        Round(e, f, g, h, a, b, c, d, 0x3956c25bul + w4);
+        Round(d, e, f, g, h, a, b, c, 0x59f111f1ul + w5);
+        Round(c, d, e, f, g, h, a, b, 0x923f82a4ul + w6);
+        Round(b, c, d, e, f, g, h, a, 0xab1c5ed5ul + w7);
+        Round(a, b, c, d, e, f, g, h, 0x5807aa98ul);
+        Round(h, a, b, c, d, e, f, g, 0x12835b01ul);
+        Round(g, h, a, b, c, d, e, f, 0x243185beul);
+        Round(f, g, h, a, b, c, d, e, 0x550c7dc3ul);
+        Round(e, f, g, h, a, b, c, d, 0x72be5d74ul);
+        Round(d, e, f, g, h, a, b, c, 0x80deb1feul);
+        Round(c, d, e, f, g, h, a, b, 0x9bdc06a7ul);
+        Round(b, c, d, e, f, g, h, a, 0xc19bf274ul);
+        Round(a, b, c, d, e, f, g, h, 0xe49b69c1ul + (w0 += sigma0(w1)));
+        Round(h, a, b, c, d, e, f, g, 0xefbe4786ul + (w1 += 0xa00000ul + sigma0(w2)));
+        Round(g, h, a, b, c, d, e, f, 0x0fc19dc6ul + (w2 += sigma1(w0) + sigma0(w3)));
+        Round(f, g, h, a, b, c, d, e, 0x240ca1ccul + (w3 += sigma1(w1) + sigma0(w4)));
+        Round(e, f, g, h, a, b, c, d, 0x2de92c6ful + (w4 += sigma1(w2) + sigma0(w5)));
+        Round(d, e, f, g, h, a, b, c, 0x4a7484aaul + (w5 += sigma1(w3) + sigma0(w6)));
+        Round(c, d, e, f, g, h, a, b, 0x5cb0a9dcul + (w6 += sigma1(w4) + 0x100ul + sigma0(w7)));
+        Round(b, c, d, e, f, g, h, a, 0x76f988daul + (w7 += sigma1(w5) + w0 + 0x11002000ul));
+        Round(a, b, c, d, e, f, g, h, 0x983e5152ul + (w8 = 0x80000000ul + sigma1(w6) + w1));
+        Round(h, a, b, c, d, e, f, g, 0xa831c66dul + (w9 = sigma1(w7) + w2));
+        Round(g, h, a, b, c, d, e, f, 0xb00327c8ul + (w10 = sigma1(w8) + w3));
+        Round(f, g, h, a, b, c, d, e, 0xbf597fc7ul + (w11 = sigma1(w9) + w4));
+        Round(e, f, g, h, a, b, c, d, 0xc6e00bf3ul + (w12 = sigma1(w10) + w5));
+        Round(d, e, f, g, h, a, b, c, 0xd5a79147ul + (w13 = sigma1(w11) + w6));
+        Round(c, d, e, f, g, h, a, b, 0x06ca6351ul + (w14 = sigma1(w12) + w7 + 0x400022ul));
+        Round(b, c, d, e, f, g, h, a, 0x14292967ul + (w15 = 0x100ul + sigma1(w13) + w8 + sigma0(w0)));
+        Round(a, b, c, d, e, f, g, h, 0x27b70a85ul + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+        Round(h, a, b, c, d, e, f, g, 0x2e1b2138ul + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+        Round(g, h, a, b, c, d, e, f, 0x4d2c6dfcul + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+        Round(f, g, h, a, b, c, d, e, 0x53380d13ul + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+        Round(e, f, g, h, a, b, c, d, 0x650a7354ul + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+        Round(d, e, f, g, h, a, b, c, 0x766a0abbul + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+        Round(c, d, e, f, g, h, a, b, 0x81c2c92eul + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+        Round(b, c, d, e, f, g, h, a, 0x92722c85ul + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+        Round(a, b, c, d, e, f, g, h, 0xa2bfe8a1ul + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+        Round(h, a, b, c, d, e, f, g, 0xa81a664bul + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+        Round(g, h, a, b, c, d, e, f, 0xc24b8b70ul + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+        Round(f, g, h, a, b, c, d, e, 0xc76c51a3ul + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+        Round(e, f, g, h, a, b, c, d, 0xd192e819ul + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+        Round(d, e, f, g, h, a, b, c, 0xd6990624ul + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+        Round(c, d, e, f, g, h, a, b, 0xf40e3585ul + (w14 += sigma1(w12) + w7 + sigma0(w15)));
+        Round(b, c, d, e, f, g, h, a, 0x106aa070ul + (w15 += sigma1(w13) + w8 + sigma0(w0)));
+        Round(a, b, c, d, e, f, g, h, 0x19a4c116ul + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+        Round(h, a, b, c, d, e, f, g, 0x1e376c08ul + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+        Round(g, h, a, b, c, d, e, f, 0x2748774cul + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+        Round(f, g, h, a, b, c, d, e, 0x34b0bcb5ul + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+        Round(e, f, g, h, a, b, c, d, 0x391c0cb3ul + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+        Round(d, e, f, g, h, a, b, c, 0x4ed8aa4aul + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+        Round(c, d, e, f, g, h, a, b, 0x5b9cca4ful + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+        Round(b, c, d, e, f, g, h, a, 0x682e6ff3ul + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+        Round(a, b, c, d, e, f, g, h, 0x748f82eeul + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+        Round(h, a, b, c, d, e, f, g, 0x78a5636ful + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+        Round(g, h, a, b, c, d, e, f, 0x84c87814ul + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+        Round(f, g, h, a, b, c, d, e, 0x8cc70208ul + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+        Round(e, f, g, h, a, b, c, d, 0x90befffaul + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+        Round(d, e, f, g, h, a, b, c, 0xa4506cebul + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+        Round(c, d, e, f, g, h, a, b, 0xbef9a3f7ul + (w14 + sigma1(w12) + w7 + sigma0(w15)));
+        Round(b, c, d, e, f, g, h, a, 0xc67178f2ul + (w15 + sigma1(w13) + w8 + sigma0(w0)));
+
+        w0 = a + 0x6a09e667ul;
+        w1 = b + 0xbb67ae85ul;
+        w2 = c + 0x3c6ef372ul;
+        w3 = d + 0xa54ff53aul;
+        w4 = e + 0x510e527ful;
+        w5 = f + 0x9b05688cul;
+        w6 = g + 0x1f83d9abul;
+        w7 = h + 0x5be0cd19ul;
+    }
+    s[0] = w0;
+    s[1] = w1;
+    s[2] = w2;
+    s[3] = w3;
+    s[4] = w4;
+    s[5] = w5;
+    s[6] = w6;
+    s[7] = w7;
+}
+
+/** Run the nonce-independent rounds 0..2 of the second block of an 80-byte header. */
+void PrepareHeaderTail(SHA256HeaderMidstate& ms, const unsigned char* tail)
+{
+    uint32_t a = ms.state[0], b = ms.state[1], c = ms.state[2], d = ms.state[3], e = ms.state[4], f = ms.state[5], g = ms.state[6], h = ms.state[7];
+    uint32_t w0 = ReadBE32(tail + 0), w1 = ReadBE32(tail + 4), w2 = ReadBE32(tail + 8);
+
+    Round(a, b, c, d, e, f, g, h, 0x428a2f98ul + w0);
+    Round(h, a, b, c, d, e, f, g, 0x71374491ul + w1);
+    Round(g, h, a, b, c, d, e, f, 0xb5c0fbcful + w2);
+
+    ms.round3[0] = a;
+    ms.round3[1] = b;
+    ms.round3[2] = c;
+    ms.round3[3] = d;
+    ms.round3[4] = e;
+    ms.round3[5] = f;
+    ms.round3[6] = g;
+    ms.round3[7] = h;
+
+    ms.w[0] = w0;
+    ms.w[1] = w1;
+    ms.w[2] = w2;
+    ms.w[3] = w0 + sigma0(w1);
+    ms.w[4] = w1 + 0x1100000ul + sigma0(w2);
+}
+
+/** Finish the second block of an 80-byte header: W3 is the nonce, W4..W15 are the padding. */
+void FinalizeHeaderTail(unsigned char* out, const SHA256HeaderMidstate& ms, uint32_t w3)
+{
+    uint32_t a = ms.round3[0], b = ms.round3[1], c = ms.round3[2], d = ms.round3[3], e = ms.round3[4], f = ms.round3[5], g = ms.round3[6], h = ms.round3[7];
+    uint32_t w0 = ms.w[3], w1 = ms.w[4], w2 = ms.w[2];
+    uint32_t w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15;
+
+    Round(f, g, h, a, b, c, d, e, 0xe9b5dba5ul + w3);
+    Round(e, f, g, h, a, b, c, d, 0xb956c25bul);
+    Round(d, e, f, g, h, a, b, c, 0x59f111f1ul);
+    Round(c, d, e, f, g, h, a, b, 0x923f82a4ul);
+    Round(b, c, d, e, f, g, h, a, 0xab1c5ed5ul);
+    Round(a, b, c, d, e, f, g, h, 0xd807aa98ul);
+    Round(h, a, b, c, d, e, f, g, 0x12835b01ul);
+    Round(g, h, a, b, c, d, e, f, 0x243185beul);
+    Round(f, g, h, a, b, c, d, e, 0x550c7dc3ul);
+    Round(e, f, g, h, a, b, c, d, 0x72be5d74ul);
+    Round(d, e, f, g, h, a, b, c, 0x80deb1feul);
+    Round(c, d, e, f, g, h, a, b, 0x9bdc06a7ul);
+    Round(b, c, d, e, f, g, h, a, 0xc19bf3f4ul);
+    Round(a, b, c, d, e, f, g, h, 0xe49b69c1ul + w0);
+    Round(h, a, b, c, d, e, f, g, 0xefbe4786ul + w1);
+    Round(g, h, a, b, c, d, e, f, 0x0fc19dc6ul + (w2 += sigma1(w0) + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, 0x240ca1ccul + (w3 += sigma1(w1) + 0x11002000ul));
+    Round(e, f, g, h, a, b, c, d, 0x2de92c6ful + (w4 = 0x80000000ul + sigma1(w2)));
+    Round(d, e, f, g, h, a, b, c, 0x4a7484aaul + (w5 = sigma1(w3)));
+    Round(c, d, e, f, g, h, a, b, 0x5cb0a9dcul + (w6 = sigma1(w4) + 0x280ul));
+    Round(b, c, d, e, f, g, h, a, 0x76f988daul + (w7 = sigma1(w5) + w0));
+    Round(a, b, c, d, e, f, g, h, 0x983e5152ul + (w8 = sigma1(w6) + w1));
+    Round(h, a, b, c, d, e, f, g, 0xa831c66dul + (w9 = sigma1(w7) + w2));
+    Round(g, h, a, b, c, d, e, f, 0xb00327c8ul + (w10 = sigma1(w8) + w3));
+    Round(f, g, h, a, b, c, d, e, 0xbf597fc7ul + (w11 = sigma1(w9) + w4));
+    Round(e, f, g, h, a, b, c, d, 0xc6e00bf3ul + (w12 = sigma1(w10) + w5));
+    Round(d, e, f, g, h, a, b, c, 0xd5a79147ul + (w13 = sigma1(w11) + w6));
+    Round(c, d, e, f, g, h, a, b, 0x06ca6351ul + (w14 = sigma1(w12) + w7 + 0xa00055ul));
+    Round(b, c, d, e, f, g, h, a, 0x14292967ul + (w15 = 0x280ul + sigma1(w13) + w8 + sigma0(w0)));
+    Round(a, b, c, d, e, f, g, h, 0x27b70a85ul + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, 0x2e1b2138ul + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, 0x4d2c6dfcul + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, 0x53380d13ul + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, 0x650a7354ul + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, 0x766a0abbul + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, 0x81c2c92eul + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, 0x92722c85ul + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, 0xa2bfe8a1ul + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, 0xa81a664bul + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, 0xc24b8b70ul + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, 0xc76c51a3ul + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, 0xd192e819ul + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, 0xd6990624ul + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, 0xf40e3585ul + (w14 += sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, 0x106aa070ul + (w15 += sigma1(w13) + w8 + sigma0(w0)));
+    Round(a, b, c, d, e, f, g, h, 0x19a4c116ul + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, 0x1e376c08ul + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, 0x2748774cul + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, 0x34b0bcb5ul + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, 0x391c0cb3ul + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, 0x4ed8aa4aul + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, 0x5b9cca4ful + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, 0x682e6ff3ul + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, 0x748f82eeul + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, 0x78a5636ful + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, 0x84c87814ul + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, 0x8cc70208ul + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, 0x90befffaul + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, 0xa4506cebul + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, 0xbef9a3f7ul + (w14 + sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, 0xc67178f2ul + (w15 + sigma1(w13) + w8 + sigma0(w0)));
+
+    WriteBE32(out + 0, a + ms.state[0]);
+    WriteBE32(out + 4, b + ms.state[1]);
+    WriteBE32(out + 8, c + ms.state[2]);
+    WriteBE32(out + 12, d + ms.state[3]);
+    WriteBE32(out + 16, e + ms.state[4]);
+    WriteBE32(out + 20, f + ms.state[5]);
+    WriteBE32(out + 24, g + ms.state[6]);
+    WriteBE32(out + 28, h + ms.state[7]);
+}
+
 } // namespace sha256
 
 typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
 typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+typedef void (*TransformChain32Type)(uint32_t*, uint32_t);
+typedef void (*TransformChain32LanesType)(uint32_t*, size_t, uint32_t);
 
 template<TransformType tr>
 void TransformD64Wrapper(unsigned char* out, const unsigned char* in)
@@ -462,6 +688,10 @@ TransformD64Type TransformD64 = sha256::TransformD64;
 TransformD64Type TransformD64_2way = nullptr;
 TransformD64Type TransformD64_4way = nullptr;
 TransformD64Type TransformD64_8way = nullptr;
+TransformChain32Type TransformChain32 = sha256::TransformChain32;
+TransformChain32LanesType TransformChain32_2way = nullptr;
+TransformChain32LanesType TransformChain32_4way = nullptr;
+TransformChain32LanesType TransformChain32_8way = nullptr;
 
 bool SelfTest() {
     // Input state (equal to the initial SHA256 state)
@@ -524,6 +754,47 @@ bool SelfTest() {
     TransformD64(out, data + 1);
     if (!std::equal(out, out + 32, result_d64)) return false;
 
+    // Test TransformChain32 against Transform on padded 32-byte messages.
+    {
+        uint32_t chain[8], expected[8];
+        unsigned char block[64] = {0};
+        for (int i = 0; i < 8; ++i) {
+            chain[i] = expected[i] = ReadBE32(data + 1 + 4 * i);
+        }
+        block[32] = 0x80;
+        block[62] = 0x01;
+        for (int n = 0; n < 3; ++n) {
+            for (int i = 0; i < 8; ++i) {
+                WriteBE32(block + 4 * i, expected[i]);
+            }
+            sha256::Initialize(expected);
+            sha256::Transform(expected, block, 1);
+        }
+        TransformChain32(chain, 3);
+        if (!std::equal(chain, chain + 8, expected)) return false;
+    }
+
+    // Test the multi-lane TransformChain32 variants, if available, against the generic one.
+    static const TransformChain32LanesType chain_lanes[3] = {TransformChain32_2way, TransformChain32_4way, TransformChain32_8way};
+    for (size_t n = 0; n < 3; ++n) {
+        if (!chain_lanes[n]) continue;
+        const size_t lanes = 2 << n;
+        uint32_t words[64], expected[8];
+        for (size_t i = 0; i < 8 * lanes; ++i) {
+            words[i] = ReadBE32(data + 1 + 4 * i);
+        }
+        chain_lanes[n](words, lanes, 3);
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            for (size_t i = 0; i < 8; ++i) {
+                expected[i] = ReadBE32(data + 1 + 4 * (i * lanes + lane));
+            }
+            sha256::TransformChain32(expected, 3);
+            for (size_t i = 0; i < 8; ++i) {
+                if (words[i * lanes + lane] != expected[i]) return false;
+            }
+        }
+    }
+
     // Test TransformD64_2way, if available.
     if (TransformD64_2way) {
         unsigned char out[64];
@@ -548,7 +819,7 @@ bool SelfTest() {
     return true;
 }
 
-#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#if defined(HAVE_GETCPUID)
 /** Check whether the OS has enabled AVX registers. */
 bool AVXEnabled()
 {
@@ -563,7 +834,7 @@ bool AVXEnabled()
 std::string SHA256AutoDetect()
 {
     std::string ret = "standard";
-#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+#if defined(HAVE_GETCPUID)
     bool have_sse4 = false;
     bool have_xsave = false;
     bool have_avx = false;
@@ -598,6 +869,8 @@ std::string SHA256AutoDetect()
         Transform = sha256_shani::Transform;
         TransformD64 = TransformD64Wrapper<sha256_shani::Transform>;
         TransformD64_2way = sha256d64_shani::Transform_2way;
+        TransformChain32 = sha256_shani::Chain32;
+        TransformChain32_2way = sha256_shani::Chain32_2way;
         ret = "shani(1way,2way)";
         have_sse4 = false; // Disable SSE4/AVX2;
         have_avx2 = false;
@@ -605,13 +878,14 @@ std::string SHA256AutoDetect()
 #endif
 
     if (have_sse4) {
-#if defined(__x86_64__) || defined(__amd64__)
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
         Transform = sha256_sse4::Transform;
         TransformD64 = TransformD64Wrapper<sha256_sse4::Transform>;
         ret = "sse4(1way)";
 #endif
 #if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
         TransformD64_4way = sha256d64_sse41::Transform_4way;
+        TransformChain32_4way = sha256_sse41::Chain32_4way;
         ret += ",sse41(4way)";
 #endif
     }
@@ -619,6 +893,7 @@ std::string SHA256AutoDetect()
 #if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
     if (have_avx2 && have_avx && enabled_avx) {
         TransformD64_8way = sha256d64_avx2::Transform_8way;
+        TransformChain32_8way = sha256_avx2::Chain32_8way;
         ret += ",avx2(8way)";
     }
 #endif
@@ -720,8 +995,65 @@ void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
     }
 }
 
+void SHA256Chain32(uint32_t* words, uint32_t iters)
+{
+    TransformChain32(words, iters);
+}
+
+size_t SHA256Chain32Width()
+{
+    if (TransformChain32_8way) return 8;
+    if (TransformChain32_4way) return 4;
+    if (TransformChain32_2way) return 2;
+    return 1;
+}
+
+void SHA256Chain32Lanes(uint32_t* words, size_t lanes, uint32_t iters)
+{
+    size_t lane = 0;
+    if (TransformChain32_8way) {
+        for (; lane + 8 <= lanes; lane += 8) {
+            TransformChain32_8way(words + lane, lanes, iters);
+        }
+    }
+    if (TransformChain32_4way) {
+        for (; lane + 4 <= lanes; lane += 4) {
+            TransformChain32_4way(words + lane, lanes, iters);
+        }
+    }
+    if (TransformChain32_2way) {
+        for (; lane + 2 <= lanes; lane += 2) {
+            TransformChain32_2way(words + lane, lanes, iters);
+        }
+    }
+    for (; lane < lanes; ++lane) {
+        uint32_t s[8];
+        for (size_t i = 0; i < 8; ++i) {
+            s[i] = words[i * lanes + lane];
+        }
+        TransformChain32(s, iters);
+        for (size_t i = 0; i < 8; ++i) {
+            words[i * lanes + lane] = s[i];
+        }
+    }
+}
+
+void SHA256PrepareHeader(SHA256HeaderMidstate& midstate, const unsigned char* header)
+{
+    sha256::Initialize(midstate.state);
+    Transform(midstate.state, header, 1);
+    sha256::PrepareHeaderTail(midstate, header + 64);
+}
+
+void SHA256FinalizeHeader(unsigned char hash[CSHA256::OUTPUT_SIZE], const SHA256HeaderMidstate& midstate, uint32_t nonce)
+{
+    unsigned char nonce_le[4];
+    WriteLE32(nonce_le, nonce);
+    sha256::FinalizeHeaderTail(hash, midstate, ReadBE32(nonce_le));
+}
+
 void sha256d(unsigned char* hash, const unsigned char* data, int len) {
-    static unsigned char temp[32] = {0};
+    unsigned char temp[32] = {0};
     CSHA256 ctx{};
     ctx.Write(data, len);
     ctx.Finalize(temp);
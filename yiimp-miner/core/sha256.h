@@ -38,6 +38,42 @@ std::string SHA256AutoDetect();
  */
 void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
 
+/** Replace a 32-byte message with its SHA256, iters times in a row.
+ *  words:  the message as 8 big-endian words on input, the final hash in the same form on output
+ *  iters:  the number of hashes to compute.
+ */
+void SHA256Chain32(uint32_t* words, uint32_t iters);
+
+/** Run SHA256Chain32 on several independent messages in lockstep.
+ *  words:  8*lanes words, word i of lane l at words[i * lanes + l]
+ *  lanes:  the number of messages; groups of SHA256Chain32Width() use the SIMD transforms.
+ *  iters:  the number of hashes to compute per lane.
+ */
+void SHA256Chain32Lanes(uint32_t* words, size_t lanes, uint32_t iters);
+
+/** Number of lanes the widest SHA256Chain32Lanes transform selected by SHA256AutoDetect processes at once. */
+size_t SHA256Chain32Width();
+
+/** Nonce-independent part of the SHA256 of an 80-byte block header.
+ *  state:  state after the first 64 bytes
+ *  round3: working variables a..h of the second block after rounds 0..2
+ *  w:      schedule words 0..2, 16 and 17 of the second block
+ */
+struct SHA256HeaderMidstate
+{
+    uint32_t state[8];
+    uint32_t round3[8];
+    uint32_t w[5];
+};
+
+/** Precompute the midstate of an 80-byte header. The nonce at bytes 76..79 is ignored. */
+void SHA256PrepareHeader(SHA256HeaderMidstate& midstate, const unsigned char* header);
+
+/** Finish the SHA256 of a header prepared by SHA256PrepareHeader with the given nonce
+ *  (as stored little-endian at bytes 76..79).
+ */
+void SHA256FinalizeHeader(unsigned char hash[CSHA256::OUTPUT_SIZE], const SHA256HeaderMidstate& midstate, uint32_t nonce);
+
 void sha256d(unsigned char* hash, const unsigned char* data, int len);
 
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,116 @@
+// Copyright (c) 2017-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation to AVX2 intrinsics of the SHA256 rounds in sha256_rounds.h,
+// processing 8 independent messages at once. The instruction set is selected for this
+// file only, callers must check for support at runtime (see SHA256AutoDetect).
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../util/common.h"
+#include "sha256_rounds.h"
+
+namespace
+{
+/** 8 lanes of 32-bit words. */
+struct Word
+{
+    __m256i v;
+
+    Word() = default;
+    explicit Word(uint32_t x) : v(_mm256_set1_epi32(x)) {}
+    explicit Word(__m256i x) : v(x) {}
+
+    Word& operator+=(Word y)
+    {
+        v = _mm256_add_epi32(v, y.v);
+        return *this;
+    }
+};
+
+inline Word operator+(Word x, Word y) { return Word(_mm256_add_epi32(x.v, y.v)); }
+inline Word operator^(Word x, Word y) { return Word(_mm256_xor_si256(x.v, y.v)); }
+inline Word operator&(Word x, Word y) { return Word(_mm256_and_si256(x.v, y.v)); }
+inline Word operator|(Word x, Word y) { return Word(_mm256_or_si256(x.v, y.v)); }
+inline Word operator>>(Word x, int n) { return Word(_mm256_srli_epi32(x.v, n)); }
+inline Word operator<<(Word x, int n) { return Word(_mm256_slli_epi32(x.v, n)); }
+
+/** Read word i of 8 consecutive 64-byte blocks. */
+inline Word Read8(const unsigned char* in, int i)
+{
+    return Word(_mm256_setr_epi32(ReadBE32(in + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 192 + 4 * i),
+      ReadBE32(in + 256 + 4 * i), ReadBE32(in + 320 + 4 * i), ReadBE32(in + 384 + 4 * i), ReadBE32(in + 448 + 4 * i)));
+}
+
+/** Write word i of 8 consecutive 32-byte hashes. */
+inline void Write8(unsigned char* out, int i, Word x)
+{
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256((__m256i*)lanes, x.v);
+    for (int j = 0; j < 8; ++j) {
+        WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+} // namespace
+
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    Word s[8], w[16];
+
+    // Transform 1: the message
+    for (int i = 0; i < 16; ++i) {
+        w[i] = Read8(in, i);
+    }
+    sha256_rounds::Initialize(s);
+    sha256_rounds::Transform(s, w);
+
+    // Transform 2: padding of a 64-byte message
+    w[0] = Word(0x80000000ul);
+    for (int i = 1; i < 15; ++i) {
+        w[i] = Word(0ul);
+    }
+    w[15] = Word(0x200ul);
+    sha256_rounds::Transform(s, w);
+
+    // Transform 3: the second SHA256 of the 32-byte hash
+    sha256_rounds::Chain32(s, 1);
+
+    for (int i = 0; i < 8; ++i) {
+        Write8(out, i, s[i]);
+    }
+}
+} // namespace sha256d64_avx2
+
+namespace sha256_avx2
+{
+void Chain32_8way(uint32_t* words, size_t stride, uint32_t iters)
+{
+    Word s[8];
+    for (int i = 0; i < 8; ++i) {
+        s[i] = Word(_mm256_loadu_si256((const __m256i*)(words + i * stride)));
+    }
+    sha256_rounds::Chain32(s, iters);
+    for (int i = 0; i < 8; ++i) {
+        _mm256_storeu_si256((__m256i*)(words + i * stride), s[i].v);
+    }
+}
+} // namespace sha256_avx2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
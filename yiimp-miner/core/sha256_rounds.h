@@ -0,0 +1,234 @@
+// Copyright (c) 2014-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 rounds written against an abstract 32-bit word type, so the same schedule
+// can be instantiated for SIMD lanes. W needs +, ^, &, |, shifts by a constant and
+// construction from a uint32_t (broadcast). Only include this from the SIMD
+// translation units, after their target pragmas.
+
+#ifndef BITCOIN_CRYPTO_SHA256_ROUNDS_H
+#define BITCOIN_CRYPTO_SHA256_ROUNDS_H
+
+#include <stdint.h>
+
+namespace sha256_rounds
+{
+template<typename W> inline W Ch(W x, W y, W z) { return z ^ (x & (y ^ z)); }
+template<typename W> inline W Maj(W x, W y, W z) { return (x & y) | (z & (x | y)); }
+template<typename W> inline W Sigma0(W x) { return (x >> 2 | x << 30) ^ (x >> 13 | x << 19) ^ (x >> 22 | x << 10); }
+template<typename W> inline W Sigma1(W x) { return (x >> 6 | x << 26) ^ (x >> 11 | x << 21) ^ (x >> 25 | x << 7); }
+template<typename W> inline W sigma0(W x) { return (x >> 7 | x << 25) ^ (x >> 18 | x << 14) ^ (x >> 3); }
+template<typename W> inline W sigma1(W x) { return (x >> 17 | x << 15) ^ (x >> 19 | x << 13) ^ (x >> 10); }
+
+/** One round of SHA-256. */
+template<typename W>
+inline void Round(W a, W b, W c, W& d, W e, W f, W g, W& h, W k)
+{
+    W t1 = h + Sigma1(e) + Ch(e, f, g) + k;
+    W t2 = Sigma0(a) + Maj(a, b, c);
+    d = d + t1;
+    h = t1 + t2;
+}
+
+/** Initialize SHA-256 state. */
+template<typename W>
+inline void Initialize(W* s)
+{
+    s[0] = W(0x6a09e667ul);
+    s[1] = W(0xbb67ae85ul);
+    s[2] = W(0x3c6ef372ul);
+    s[3] = W(0xa54ff53aul);
+    s[4] = W(0x510e527ful);
+    s[5] = W(0x9b05688cul);
+    s[6] = W(0x1f83d9abul);
+    s[7] = W(0x5be0cd19ul);
+}
+
+/** One SHA-256 transformation of the 16 message words w. */
+template<typename W>
+inline void Transform(W* s, const W* w)
+{
+    W a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    W w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15;
+
+    Round(a, b, c, d, e, f, g, h, W(0x428a2f98ul) + (w0 = w[0]));
+    Round(h, a, b, c, d, e, f, g, W(0x71374491ul) + (w1 = w[1]));
+    Round(g, h, a, b, c, d, e, f, W(0xb5c0fbcful) + (w2 = w[2]));
+    Round(f, g, h, a, b, c, d, e, W(0xe9b5dba5ul) + (w3 = w[3]));
+    Round(e, f, g, h, a, b, c, d, W(0x3956c25bul) + (w4 = w[4]));
+    Round(d, e, f, g, h, a, b, c, W(0x59f111f1ul) + (w5 = w[5]));
+    Round(c, d, e, f, g, h, a, b, W(0x923f82a4ul) + (w6 = w[6]));
+    Round(b, c, d, e, f, g, h, a, W(0xab1c5ed5ul) + (w7 = w[7]));
+    Round(a, b, c, d, e, f, g, h, W(0xd807aa98ul) + (w8 = w[8]));
+    Round(h, a, b, c, d, e, f, g, W(0x12835b01ul) + (w9 = w[9]));
+    Round(g, h, a, b, c, d, e, f, W(0x243185beul) + (w10 = w[10]));
+    Round(f, g, h, a, b, c, d, e, W(0x550c7dc3ul) + (w11 = w[11]));
+    Round(e, f, g, h, a, b, c, d, W(0x72be5d74ul) + (w12 = w[12]));
+    Round(d, e, f, g, h, a, b, c, W(0x80deb1feul) + (w13 = w[13]));
+    Round(c, d, e, f, g, h, a, b, W(0x9bdc06a7ul) + (w14 = w[14]));
+    Round(b, c, d, e, f, g, h, a, W(0xc19bf174ul) + (w15 = w[15]));
+
+    Round(a, b, c, d, e, f, g, h, W(0xe49b69c1ul) + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, W(0xefbe4786ul) + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, W(0x0fc19dc6ul) + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, W(0x240ca1ccul) + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, W(0x2de92c6ful) + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, W(0x4a7484aaul) + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, W(0x5cb0a9dcul) + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, W(0x76f988daul) + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, W(0x983e5152ul) + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, W(0xa831c66dul) + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, W(0xb00327c8ul) + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, W(0xbf597fc7ul) + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, W(0xc6e00bf3ul) + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, W(0xd5a79147ul) + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, W(0x06ca6351ul) + (w14 += sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, W(0x14292967ul) + (w15 += sigma1(w13) + w8 + sigma0(w0)));
+
+    Round(a, b, c, d, e, f, g, h, W(0x27b70a85ul) + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, W(0x2e1b2138ul) + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, W(0x4d2c6dfcul) + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, W(0x53380d13ul) + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, W(0x650a7354ul) + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, W(0x766a0abbul) + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, W(0x81c2c92eul) + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, W(0x92722c85ul) + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, W(0xa2bfe8a1ul) + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, W(0xa81a664bul) + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, W(0xc24b8b70ul) + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, W(0xc76c51a3ul) + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, W(0xd192e819ul) + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, W(0xd6990624ul) + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, W(0xf40e3585ul) + (w14 += sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, W(0x106aa070ul) + (w15 += sigma1(w13) + w8 + sigma0(w0)));
+
+    Round(a, b, c, d, e, f, g, h, W(0x19a4c116ul) + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, W(0x1e376c08ul) + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, W(0x2748774cul) + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, W(0x34b0bcb5ul) + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, W(0x391c0cb3ul) + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, W(0x4ed8aa4aul) + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, W(0x5b9cca4ful) + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, W(0x682e6ff3ul) + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, W(0x748f82eeul) + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, W(0x78a5636ful) + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, W(0x84c87814ul) + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, W(0x8cc70208ul) + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, W(0x90befffaul) + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, W(0xa4506cebul) + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, W(0xbef9a3f7ul) + (w14 + sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, W(0xc67178f2ul) + (w15 + sigma1(w13) + w8 + sigma0(w0)));
+
+    s[0] = s[0] + a;
+    s[1] = s[1] + b;
+    s[2] = s[2] + c;
+    s[3] = s[3] + d;
+    s[4] = s[4] + e;
+    s[5] = s[5] + f;
+    s[6] = s[6] + g;
+    s[7] = s[7] + h;
+}
+
+/** Hash a 32-byte message given as 8 words in place, iters times. See sha256::TransformChain32. */
+template<typename W>
+inline void Chain32(W* s, uint32_t iters)
+{
+    W w0 = s[0], w1 = s[1], w2 = s[2], w3 = s[3], w4 = s[4], w5 = s[5], w6 = s[6], w7 = s[7];
+    while (iters--) {
+        W a = W(0x6a09e667ul);
+        W b = W(0xbb67ae85ul);
+        W c = W(0x3c6ef372ul);
+        W d = W(0xa54ff53aul);
+        W e = W(0x510e527ful);
+        W f = W(0x9b05688cul);
+        W g = W(0x1f83d9abul);
+        W h = W(0x5be0cd19ul);
+        W w8, w9, w10, w11, w12, w13, w14, w15;
+
+        Round(a, b, c, d, e, f, g, h, W(0x428a2f98ul) + w0);
+        Round(h, a, b, c, d, e, f, g, W(0x71374491ul) + w1);
+        Round(g, h, a, b, c, d, e, f, W(0xb5c0fbcful) + w2);
+        Round(f, g, h, a, b, c, d, e, W(0xe9b5dba5ul) + w3);
+        Round(e, f, g, h, a, b, c, d, W(0x3956c25bul) + w4);
+        Round(d, e, f, g, h, a, b, c, W(0x59f111f1ul) + w5);
+        Round(c, d, e, f, g, h, a, b, W(0x923f82a4ul) + w6);
+        Round(b, c, d, e, f, g, h, a, W(0xab1c5ed5ul) + w7);
+        Round(a, b, c, d, e, f, g, h, W(0x5807aa98ul));
+        Round(h, a, b, c, d, e, f, g, W(0x12835b01ul));
+        Round(g, h, a, b, c, d, e, f, W(0x243185beul));
+        Round(f, g, h, a, b, c, d, e, W(0x550c7dc3ul));
+        Round(e, f, g, h, a, b, c, d, W(0x72be5d74ul));
+        Round(d, e, f, g, h, a, b, c, W(0x80deb1feul));
+        Round(c, d, e, f, g, h, a, b, W(0x9bdc06a7ul));
+        Round(b, c, d, e, f, g, h, a, W(0xc19bf274ul));
+        Round(a, b, c, d, e, f, g, h, W(0xe49b69c1ul) + (w0 += sigma0(w1)));
+        Round(h, a, b, c, d, e, f, g, W(0xefbe4786ul) + (w1 += W(0xa00000ul) + sigma0(w2)));
+        Round(g, h, a, b, c, d, e, f, W(0x0fc19dc6ul) + (w2 += sigma1(w0) + sigma0(w3)));
+        Round(f, g, h, a, b, c, d, e, W(0x240ca1ccul) + (w3 += sigma1(w1) + sigma0(w4)));
+        Round(e, f, g, h, a, b, c, d, W(0x2de92c6ful) + (w4 += sigma1(w2) + sigma0(w5)));
+        Round(d, e, f, g, h, a, b, c, W(0x4a7484aaul) + (w5 += sigma1(w3) + sigma0(w6)));
+        Round(c, d, e, f, g, h, a, b, W(0x5cb0a9dcul) + (w6 += sigma1(w4) + W(0x100ul) + sigma0(w7)));
+        Round(b, c, d, e, f, g, h, a, W(0x76f988daul) + (w7 += sigma1(w5) + w0 + W(0x11002000ul)));
+        Round(a, b, c, d, e, f, g, h, W(0x983e5152ul) + (w8 = W(0x80000000ul) + sigma1(w6) + w1));
+        Round(h, a, b, c, d, e, f, g, W(0xa831c66dul) + (w9 = sigma1(w7) + w2));
+        Round(g, h, a, b, c, d, e, f, W(0xb00327c8ul) + (w10 = sigma1(w8) + w3));
+        Round(f, g, h, a, b, c, d, e, W(0xbf597fc7ul) + (w11 = sigma1(w9) + w4));
+        Round(e, f, g, h, a, b, c, d, W(0xc6e00bf3ul) + (w12 = sigma1(w10) + w5));
+        Round(d, e, f, g, h, a, b, c, W(0xd5a79147ul) + (w13 = sigma1(w11) + w6));
+        Round(c, d, e, f, g, h, a, b, W(0x06ca6351ul) + (w14 = sigma1(w12) + w7 + W(0x400022ul)));
+        Round(b, c, d, e, f, g, h, a, W(0x14292967ul) + (w15 = W(0x100ul) + sigma1(w13) + w8 + sigma0(w0)));
+        Round(a, b, c, d, e, f, g, h, W(0x27b70a85ul) + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+        Round(h, a, b, c, d, e, f, g, W(0x2e1b2138ul) + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+        Round(g, h, a, b, c, d, e, f, W(0x4d2c6dfcul) + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+        Round(f, g, h, a, b, c, d, e, W(0x53380d13ul) + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+        Round(e, f, g, h, a, b, c, d, W(0x650a7354ul) + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+        Round(d, e, f, g, h, a, b, c, W(0x766a0abbul) + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+        Round(c, d, e, f, g, h, a, b, W(0x81c2c92eul) + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+        Round(b, c, d, e, f, g, h, a, W(0x92722c85ul) + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+        Round(a, b, c, d, e, f, g, h, W(0xa2bfe8a1ul) + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+        Round(h, a, b, c, d, e, f, g, W(0xa81a664bul) + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+        Round(g, h, a, b, c, d, e, f, W(0xc24b8b70ul) + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+        Round(f, g, h, a, b, c, d, e, W(0xc76c51a3ul) + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+        Round(e, f, g, h, a, b, c, d, W(0xd192e819ul) + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+        Round(d, e, f, g, h, a, b, c, W(0xd6990624ul) + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+        Round(c, d, e, f, g, h, a, b, W(0xf40e3585ul) + (w14 += sigma1(w12) + w7 + sigma0(w15)));
+        Round(b, c, d, e, f, g, h, a, W(0x106aa070ul) + (w15 += sigma1(w13) + w8 + sigma0(w0)));
+        Round(a, b, c, d, e, f, g, h, W(0x19a4c116ul) + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+        Round(h, a, b, c, d, e, f, g, W(0x1e376c08ul) + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+        Round(g, h, a, b, c, d, e, f, W(0x2748774cul) + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+        Round(f, g, h, a, b, c, d, e, W(0x34b0bcb5ul) + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+        Round(e, f, g, h, a, b, c, d, W(0x391c0cb3ul) + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+        Round(d, e, f, g, h, a, b, c, W(0x4ed8aa4aul) + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+        Round(c, d, e, f, g, h, a, b, W(0x5b9cca4ful) + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+        Round(b, c, d, e, f, g, h, a, W(0x682e6ff3ul) + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+        Round(a, b, c, d, e, f, g, h, W(0x748f82eeul) + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+        Round(h, a, b, c, d, e, f, g, W(0x78a5636ful) + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+        Round(g, h, a, b, c, d, e, f, W(0x84c87814ul) + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+        Round(f, g, h, a, b, c, d, e, W(0x8cc70208ul) + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+        Round(e, f, g, h, a, b, c, d, W(0x90befffaul) + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+        Round(d, e, f, g, h, a, b, c, W(0xa4506cebul) + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+        Round(c, d, e, f, g, h, a, b, W(0xbef9a3f7ul) + (w14 + sigma1(w12) + w7 + sigma0(w15)));
+        Round(b, c, d, e, f, g, h, a, W(0xc67178f2ul) + (w15 + sigma1(w13) + w8 + sigma0(w0)));
+
+        w0 = a + W(0x6a09e667ul);
+        w1 = b + W(0xbb67ae85ul);
+        w2 = c + W(0x3c6ef372ul);
+        w3 = d + W(0xa54ff53aul);
+        w4 = e + W(0x510e527ful);
+        w5 = f + W(0x9b05688cul);
+        w6 = g + W(0x1f83d9abul);
+        w7 = h + W(0x5be0cd19ul);
+    }
+    s[0] = w0;
+    s[1] = w1;
+    s[2] = w2;
+    s[3] = w3;
+    s[4] = w4;
+    s[5] = w5;
+    s[6] = w6;
+    s[7] = w7;
+}
+} // namespace sha256_rounds
+
+#endif // BITCOIN_CRYPTO_SHA256_ROUNDS_H
@@ -0,0 +1,115 @@
+// Copyright (c) 2017-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation to SSE4.1 intrinsics of the SHA256 rounds in sha256_rounds.h,
+// processing 4 independent messages at once. The instruction set is selected for this
+// file only, callers must check for support at runtime (see SHA256AutoDetect).
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("sse4.1")
+#endif
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../util/common.h"
+#include "sha256_rounds.h"
+
+namespace
+{
+/** 4 lanes of 32-bit words. */
+struct Word
+{
+    __m128i v;
+
+    Word() = default;
+    explicit Word(uint32_t x) : v(_mm_set1_epi32(x)) {}
+    explicit Word(__m128i x) : v(x) {}
+
+    Word& operator+=(Word y)
+    {
+        v = _mm_add_epi32(v, y.v);
+        return *this;
+    }
+};
+
+inline Word operator+(Word x, Word y) { return Word(_mm_add_epi32(x.v, y.v)); }
+inline Word operator^(Word x, Word y) { return Word(_mm_xor_si128(x.v, y.v)); }
+inline Word operator&(Word x, Word y) { return Word(_mm_and_si128(x.v, y.v)); }
+inline Word operator|(Word x, Word y) { return Word(_mm_or_si128(x.v, y.v)); }
+inline Word operator>>(Word x, int n) { return Word(_mm_srli_epi32(x.v, n)); }
+inline Word operator<<(Word x, int n) { return Word(_mm_slli_epi32(x.v, n)); }
+
+/** Read word i of 4 consecutive 64-byte blocks. */
+inline Word Read4(const unsigned char* in, int i)
+{
+    return Word(_mm_setr_epi32(ReadBE32(in + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 192 + 4 * i)));
+}
+
+/** Write word i of 4 consecutive 32-byte hashes. */
+inline void Write4(unsigned char* out, int i, Word x)
+{
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128((__m128i*)lanes, x.v);
+    for (int j = 0; j < 4; ++j) {
+        WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+} // namespace
+
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    Word s[8], w[16];
+
+    // Transform 1: the message
+    for (int i = 0; i < 16; ++i) {
+        w[i] = Read4(in, i);
+    }
+    sha256_rounds::Initialize(s);
+    sha256_rounds::Transform(s, w);
+
+    // Transform 2: padding of a 64-byte message
+    w[0] = Word(0x80000000ul);
+    for (int i = 1; i < 15; ++i) {
+        w[i] = Word(0ul);
+    }
+    w[15] = Word(0x200ul);
+    sha256_rounds::Transform(s, w);
+
+    // Transform 3: the second SHA256 of the 32-byte hash
+    sha256_rounds::Chain32(s, 1);
+
+    for (int i = 0; i < 8; ++i) {
+        Write4(out, i, s[i]);
+    }
+}
+} // namespace sha256d64_sse41
+
+namespace sha256_sse41
+{
+void Chain32_4way(uint32_t* words, size_t stride, uint32_t iters)
+{
+    Word s[8];
+    for (int i = 0; i < 8; ++i) {
+        s[i] = Word(_mm_loadu_si128((const __m128i*)(words + i * stride)));
+    }
+    sha256_rounds::Chain32(s, iters);
+    for (int i = 0; i < 8; ++i) {
+        _mm_storeu_si128((__m128i*)(words + i * stride), s[i].v);
+    }
+}
+} // namespace sha256_sse41
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
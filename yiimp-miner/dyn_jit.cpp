@@ -0,0 +1,242 @@
+#include "dyn_jit.h"
+
+#include "util/common.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define HAVE_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+jit_program_t::~jit_program_t() {
+#ifdef HAVE_JIT
+    if (arena) munmap(arena, arena_size);
+#endif
+}
+
+#ifdef HAVE_JIT
+
+namespace {
+
+// ops that are not worth inlining, called with the frame and a pointer to the op's arguments
+void jit_sha(jit_frame_t* frame, const uint32_t* args) { frame->state.sha(args[0]); }
+void jit_memgen(jit_frame_t* frame, const uint32_t* args) { frame->state.memgen(args); }
+void jit_memadd(jit_frame_t* frame, const uint32_t* args) { frame->state.memadd(args); }
+void jit_memxor(jit_frame_t* frame, const uint32_t* args) { frame->state.memxor(args); }
+void jit_mem_fused(jit_frame_t* frame, const uint32_t* args) { frame->state.mem_fused(args); }
+void jit_mem_select(jit_frame_t* frame, const uint32_t* args) { frame->state.mem_select(args); }
+
+const uint32_t one_iteration = 1;
+
+// x86-64 System V code generation, the frame pointer is kept in rbx
+struct emitter_t {
+    std::vector<uint8_t> code{};
+
+    void bytes(std::initializer_list<uint8_t> b) { code.insert(code.end(), b); }
+
+    void imm32(uint32_t v) {
+        for (int i = 0; i < 4; i++)
+            code.push_back(uint8_t(v >> (8 * i)));
+    }
+
+    void imm64(uint64_t v) {
+        for (int i = 0; i < 8; i++)
+            code.push_back(uint8_t(v >> (8 * i)));
+    }
+
+    // ModRM (+ displacement) addressing [rbx + disp]
+    void rbx_operand(uint8_t reg, uint32_t disp) {
+        if (disp < 128) {
+            bytes({ uint8_t(0x43 | reg << 3), uint8_t(disp) });
+        } else {
+            bytes({ uint8_t(0x83 | reg << 3) });
+            imm32(disp);
+        }
+    }
+
+    // add/xor dword [rbx + disp], imm
+    void alu_imm(uint8_t ext, uint32_t disp, uint32_t imm) {
+        const bool short_imm = int32_t(imm) >= -128 && int32_t(imm) <= 127;
+        bytes({ uint8_t(short_imm ? 0x83 : 0x81) });
+        rbx_operand(ext, disp);
+        if (short_imm)
+            bytes({ uint8_t(imm) });
+        else
+            imm32(imm);
+    }
+
+    void prologue() {
+        bytes({ 0x53 });             // push rbx
+        bytes({ 0x48, 0x89, 0xfb }); // mov rbx, rdi
+    }
+
+    void call(void (*fn)(jit_frame_t*, const uint32_t*), const uint32_t* args) {
+        bytes({ 0x48, 0x89, 0xdf }); // mov rdi, rbx
+        bytes({ 0x48, 0xbe });       // mov rsi, args
+        imm64(uint64_t(args));
+        bytes({ 0x48, 0xb8 }); // mov rax, fn
+        imm64(uint64_t(fn));
+        bytes({ 0xff, 0xd0 }); // call rax
+    }
+
+    // sets bit `lane` of edx when the first 8 bytes of the lane's hash, read big-endian, are <= target
+    void check_target(size_t lanes, size_t lane) {
+        bytes({ 0x8b });
+        rbx_operand(0, uint32_t(lane * 4)); // mov eax, word 0
+        bytes({ 0x0f, 0xc8 });              // bswap eax
+        bytes({ 0x48, 0xc1, 0xe0, 0x20 });  // shl rax, 32
+        bytes({ 0x8b });
+        rbx_operand(1, uint32_t((lanes + lane) * 4)); // mov ecx, word 1
+        bytes({ 0x0f, 0xc9 });                        // bswap ecx
+        bytes({ 0x48, 0x09, 0xc8 });                  // or rax, rcx
+        bytes({ 0x48, 0x3b });
+        rbx_operand(0, uint32_t(offsetof(jit_frame_t, target))); // cmp rax, target
+        bytes({ 0x0f, 0x96, 0xc1 });                             // setbe cl
+        bytes({ 0x0f, 0xb6, 0xc9 });                             // movzx ecx, cl
+        if (lane) bytes({ 0xc1, 0xe1, uint8_t(lane) });          // shl ecx, lane
+        bytes({ 0x09, 0xca });                                   // or edx, ecx
+    }
+
+    void epilogue() {
+        bytes({ 0x89, 0xd0 }); // mov eax, edx
+        bytes({ 0x5b });       // pop rbx
+        bytes({ 0xc3 });       // ret
+    }
+};
+
+static_assert(offsetof(jit_frame_t, state) == 0 && offsetof(lanes_state_t, hash) == 0,
+  "the generated code expects the running hash at the start of the frame");
+
+// false when the program has to stay with the interpreter
+bool emit_program(emitter_t& em, const std::vector<uint32_t>& bytecode, size_t lanes) {
+    em.prologue();
+    size_t pos = 0;
+    while (pos < bytecode.size()) {
+        const hashop op = static_cast<hashop>(bytecode[pos++]);
+        const uint32_t* args = bytecode.data() + pos;
+        switch (op) {
+        case hashop::ADD:
+        case hashop::XOR:
+            for (uint32_t i = 0; i < 8; i++) {
+                if (args[i] == 0) continue;
+                for (size_t lane = 0; lane < lanes; lane++)
+                    em.alu_imm(op == hashop::ADD ? 0 : 6, uint32_t((i * lanes + lane) * 4), args[i]);
+            }
+            pos += 8;
+            break;
+        case hashop::SHA_SINGLE:
+            em.call(jit_sha, &one_iteration);
+            break;
+        case hashop::SHA_LOOP:
+            em.call(jit_sha, args);
+            pos += 1;
+            break;
+        case hashop::MEMGEN:
+            // without SHA2 the pool keeps what earlier nonces left in it, the self-check cannot reproduce that
+            if (static_cast<hashop>(args[0]) != hashop::SHA_SINGLE) return false;
+            em.call(jit_memgen, args);
+            pos += 2;
+            break;
+        case hashop::MEMADD:
+            em.call(jit_memadd, args);
+            pos += 8;
+            break;
+        case hashop::MEMXOR:
+            em.call(jit_memxor, args);
+            pos += 8;
+            break;
+        case hashop::MEM_FUSED:
+            em.call(jit_mem_fused, args);
+            pos += 1 + args[0] * 9;
+            break;
+        case hashop::MEM_SELECT:
+            em.call(jit_mem_select, args);
+            pos += 1;
+            break;
+        case hashop::UNKNOWN:
+            break;
+        }
+    }
+
+    em.bytes({ 0x31, 0xd2 }); // xor edx, edx
+    for (size_t lane = 0; lane < lanes; lane++)
+        em.check_target(lanes, lane);
+    em.epilogue();
+    return true;
+}
+
+// compares the code with the interpreter on made-up header hashes, with a target between the lanes' hashes
+bool self_check(const jit_program_t& jit, const program_t& program, const char* prev_block_hash, const char* merkle_root) {
+    const size_t lanes = jit.lanes;
+    mempool_t mempool(32 * 32);
+    jit_frame_t frame(lanes, program, prev_block_hash, merkle_root, mempool);
+
+    uint32_t header_hashes[8 * max_lanes];
+    unsigned char expected[32 * max_lanes];
+    unsigned char actual[32 * max_lanes];
+    uint32_t seed = 0x9e3779b9;
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < 8 * lanes; i++) {
+            seed = seed * 1664525 + 1013904223;
+            header_hashes[i] = seed;
+        }
+        execute_program_lanes(expected, header_hashes, lanes, program, prev_block_hash, merkle_root, mempool);
+
+        frame.target = ReadBE64(expected);
+        uint32_t expected_found = 0;
+        for (size_t lane = 0; lane < lanes; lane++)
+            if (ReadBE64(expected + 32 * lane) <= frame.target) expected_found |= 1u << lane;
+
+        const uint32_t found = jit.run(frame, header_hashes);
+        frame.state.store(actual);
+        if (found != expected_found || memcmp(actual, expected, 32 * lanes) != 0) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<const jit_program_t> jit_compile(
+  const program_t& program, size_t lanes, const char* prev_block_hash, const char* merkle_root) {
+    auto jit = std::make_shared<jit_program_t>();
+    jit->lanes = lanes;
+    jit->bytecode = program.bytecode;
+
+    emitter_t em;
+    if (!emit_program(em, jit->bytecode, lanes)) {
+        printf("JIT: program has a MEMGEN without SHA2, using the interpreter\n");
+        return nullptr;
+    }
+
+    const size_t page = sysconf(_SC_PAGESIZE);
+    jit->arena_size = (em.code.size() + page - 1) / page * page;
+    void* arena = mmap(nullptr, jit->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        printf("JIT: cannot map %zu bytes, using the interpreter\n", jit->arena_size);
+        return nullptr;
+    }
+    jit->arena = arena;
+    memcpy(arena, em.code.data(), em.code.size());
+    if (mprotect(arena, jit->arena_size, PROT_READ | PROT_EXEC) != 0) {
+        printf("JIT: cannot make code executable, using the interpreter\n");
+        return nullptr;
+    }
+    jit->entry = reinterpret_cast<jit_program_t::entry_t>(arena);
+
+    if (!self_check(*jit, program, prev_block_hash, merkle_root)) {
+        printf("JIT: self-check failed, using the interpreter\n");
+        return nullptr;
+    }
+    return jit;
+}
+
+#else
+
+std::shared_ptr<const jit_program_t> jit_compile(const program_t&, size_t, const char*, const char*) { return nullptr; }
+
+#endif
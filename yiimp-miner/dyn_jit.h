@@ -0,0 +1,47 @@
+#pragma once
+
+#include "dynprogram.h"
+
+#include <memory>
+#include <vector>
+
+// what the generated code works on; the code addresses the running hash at offset 0 and `target` by offset
+struct jit_frame_t {
+    lanes_state_t state;
+    uint64_t target = 0; // share target, see `work_t::share_target`
+
+    jit_frame_t(
+      std::size_t lanes,
+      const program_t& program,
+      const char* prev_block_hash,
+      const char* merkle_root,
+      mempool_t& mempool)
+        : state(lanes, program, prev_block_hash, merkle_root, mempool) {}
+};
+
+// native code of one program, immutable once compiled and shared by all CPU threads
+struct jit_program_t {
+    using entry_t = uint32_t (*)(jit_frame_t*);
+
+    std::size_t lanes = 1;
+    std::vector<uint32_t> bytecode{}; // the code points into it for op arguments
+    void* arena = nullptr;
+    std::size_t arena_size = 0;
+    entry_t entry = nullptr;
+
+    jit_program_t() = default;
+    jit_program_t(const jit_program_t&) = delete;
+    ~jit_program_t();
+
+    // runs the program on `lanes` consecutive header hashes, bit `l` of the result is set
+    // when the hash of lane `l` is within `frame.target`
+    inline uint32_t run(jit_frame_t& frame, const uint32_t* header_hashes) const {
+        frame.state.load(header_hashes);
+        return entry(&frame);
+    }
+};
+
+// compiles `program` for `lanes` nonces at once and checks the code against `execute_program_lanes` on the
+// job's memory slots; nullptr when the platform has no JIT or the check fails, the interpreter is used then
+std::shared_ptr<const jit_program_t> jit_compile(
+  const program_t& program, std::size_t lanes, const char* prev_block_hash, const char* merkle_root);
@@ -8,9 +8,10 @@
 #include "dynprogram.h"
 #include "nlohmann/json.hpp"
 #include "core/sha256.h"
+#include "util/alloc_guard.h"
 #include "util/common.h"
 #include "util/hex.h"
-#include "util/rand.h"
+#include "util/nonce.h"
 #include "util/sockets.h"
 #include "util/stats.h"
 
@@ -27,6 +28,7 @@
 #include <sched.h>
 #endif
 
+#include <mutex>
 #include <thread>
 
 #ifdef DEBUG_LOGS
@@ -36,6 +38,62 @@
     {}
 #endif
 
+#ifdef ALLOC_GUARD
+// counting allocator for `alloc_guard_t`; glibc lets the executable interpose malloc itself, elsewhere
+// only operator new is replaced
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) {
+    alloc_guard_t::count();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    alloc_guard_t::count();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    alloc_guard_t::count();
+    return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    alloc_guard_t::count();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    alloc_guard_t::count();
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+}
+#else
+void* operator new(size_t size) {
+    alloc_guard_t::count();
+    if (void* ptr = malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    alloc_guard_t::count();
+    if (void* ptr = malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+#endif
+#endif
+
 using json = nlohmann::json;
 
 enum class miner_device {
@@ -54,15 +112,43 @@ struct dyn_miner {
     int gpu_platform_id{};
     int local_work_size{};
 
-    rand_seed_t rand_seed{};
+    uint32_t gpu_devices = 0;
+    uint32_t cpu_threads = 0;
+    nonce_partition_t nonces{}; // one range per GPU and CPU thread, in the order of `stats_t::workers`
+
+    cpu_engine_kind cpu_engine = cpu_engine_kind::jit;
+    std::atomic<uint32_t> engine_request{}; // latest `build_cpu_engine` call, older builds are dropped
+    std::mutex engine_mutex{};
+
+    // of the current connection, see `set_extranonce` and `set_version_mask`
+    std::vector<unsigned char> extranonce1{};
+    uint32_t extranonce2_size = 0;
+    bool version_rolling = false; // ask for BIP310 version rolling, see `--version-rolling`
+    uint32_t version_mask = 0;
+    uint32_t ntime_window = 0; // see `--ntime-roll`
 
     dyn_miner() = default;
 
-    void start_cpu(uint32_t);
+    void start_cpu(uint32_t cpu);
     void start_gpu(uint32_t gpuIndex);
-    void set_job(const json& msg, miner_device device);
+    void set_job(const json& msg);
+    void build_cpu_engine(const work_t& work);
+    void roll_exhausted_jobs();
     void wait_for_work();
 
+    // from mining.subscribe or mining.set_extranonce, used from the next job on
+    inline void set_extranonce(const std::string& hex_extranonce1, uint32_t new_extranonce2_size) {
+        extranonce1 = hex2bytes(hex_extranonce1);
+        extranonce2_size = new_extranonce2_size;
+        printf("Extranonce1 %s, extranonce2 of %u bytes\n", hex_extranonce1.c_str(), extranonce2_size);
+    }
+
+    // from mining.configure or mining.set_version_mask, used from the next job on
+    inline void set_version_mask(const std::string& hex_mask) {
+        version_mask = strtoul(hex_mask.c_str(), nullptr, 16);
+        printf("Version rolling mask %08x\n", version_mask);
+    }
+
     inline void set_difficulty(double diff) {
         shared_work.set_difficulty(diff);
         shares.stats.latest_diff = static_cast<uint32_t>(diff);
@@ -78,73 +164,225 @@ void dyn_miner::wait_for_work() {
 #ifdef GPU_MINER
 void dyn_miner::start_gpu(uint32_t gpu) {
     wait_for_work();
+    // kernel runs cover `compute_units` nonces
+    batch_sizer_t sizer(compute_units, std::chrono::milliseconds(200));
     while (true) {
-        gpu_program.start_miner(shared_work, compute_units, gpu, shares, rand_seed, local_work_size);
+        gpu_program.start_miner(shared_work, compute_units, gpu, shares, sizer, local_work_size);
     }
 }
 #endif
 
 void cpu_miner(
-  shared_work_t& shared_work, shares_t& shares, uint32_t index, rand_seed_t rand_seed, mempool_t& mempool) {
-    work_t work = shared_work.clone();
-    uint32_t nonce = rand_seed.rand_with_index(index);
-
-    unsigned char header[80];
-    memcpy(header, work.native_data, 80);
-    memcpy(header + 76, &nonce, 4);
-
-    unsigned char result[32];
+  shared_work_t& shared_work,
+  shares_t& shares,
+  uint32_t index,
+  batch_sizer_t& sizer,
+  mempool_t& mempool) {
+    const std::shared_ptr<const work_t> snapshot = shared_work.snapshot();
+    const work_t& work = *snapshot;
+    hash_counter_t& hashes = shares.stats.workers[index];
+    shares.stats.switch_latency[index].record(work.num, work.published);
+    nonce_scheduler_t& nonces = *work.nonces;
+    nonce_batch_t batch{};
+
+    // run as many nonces in lockstep as the SHA256 transform has SIMD lanes
+    const size_t lanes = SHA256Chain32Width();
+
+    uint32_t header_hashes[8 * max_lanes];
+    unsigned char results[32 * max_lanes];
+
+    // starts on the interpreter and switches to the optimized engine once it is built for the program
+    const program_t* program = &work.cpu_program;
+    program_t engine_program{};
+    std::shared_ptr<const cpu_engine_t> engine{};
+    uint32_t engine_num = ~shared_work.engine_num.load(std::memory_order_acquire);
+    // long SHA loops and MEMGENs give up once the job is replaced
+    cancel_t cancel{&shared_work.num, work.num};
+    jit_frame_t frame(lanes, *program, work.prev_block_hash, work.merkle_root, mempool);
+    frame.target = work.share_target;
+    frame.state.cancel = &cancel;
+    // the pool only grows, sized up front hashing never allocates
+    mempool.resize(size_t(program->largest_memgen()) * 32 * lanes);
     while (shared_work == work) {
-        execute_program(result, header, work.cpu_program, work.prev_block_hash, work.merkle_root, mempool);
-        shares.stats.nonce_count++;
+        if (batch.empty()) {
+            sizer.finish();
+            batch = nonces.take(index, sizer.size);
+            if (batch.empty()) {
+                if (!nonces.exhausted.test_and_set()) shared_work.exhausted(work);
+                shared_work.wait_for_next(work);
+                return;
+            }
+            sizer.start(batch.size());
+        }
+        const uint32_t nonce = nonces.nonce(batch.first);
+
+        if (shared_work.engine_num.load(std::memory_order_acquire) != engine_num) {
+            engine_num = shared_work.engine_num.load(std::memory_order_acquire);
+            std::shared_ptr<const cpu_engine_t> latest = shared_work.engine.load();
+            if (latest && latest->str_program == work.str_program) {
+                engine = std::move(latest);
+                engine_program = engine->program;
+                engine_program.resolve_memgen(work.prev_block_hash, work.merkle_root);
+                program = &engine_program;
+                frame = jit_frame_t(lanes, *program, work.prev_block_hash, work.merkle_root, mempool);
+                frame.target = work.share_target;
+                frame.state.cancel = &cancel;
+                mempool.resize(size_t(program->largest_memgen()) * 32 * lanes);
+            }
+        }
 
-        uint64_t hash_int = htobe64(*(uint64_t*)&result[0]);
-        if (hash_int <= work.share_target) {
-            const share_t share = work.share((char*)header + 76);
-            shares.append(share);
+        // bit `lane` is set when the lane's hash is a share
+        uint32_t found = 0;
+        {
+#ifdef ALLOC_GUARD
+            alloc_guard_t guard("cpu_miner");
+#endif
+            // only the second block of the header depends on the nonce
+            for (size_t lane = 0; lane < lanes; lane++) {
+                SHA256FinalizeHeader((unsigned char*)(header_hashes + lane * 8), work.midstate, nonce + lane);
+            }
+
+            if (engine && engine->jit) {
+                found = engine->jit->run(frame, header_hashes);
+            } else {
+                if (engine && engine->threaded) {
+                    engine->threaded->run(frame.state, header_hashes);
+                    frame.state.store(results);
+                } else {
+                    execute_program_lanes(results, header_hashes, lanes, *program, work.prev_block_hash,
+                      work.merkle_root, mempool, &cancel);
+                }
+                for (size_t lane = 0; lane < lanes; lane++) {
+                    uint64_t hash_int = htobe64(*(uint64_t*)&results[lane * 32]);
+                    if (hash_int <= work.share_target) found |= 1u << lane;
+                }
+            }
+        }
+        if (cancel.cancelled) break;
+        hashes.add(lanes);
+
+        if (found) {
+            // the JIT only reports which lanes found a share
+            if (engine && engine->jit) frame.state.store(results);
+            for (size_t lane = 0; lane < lanes; lane++) {
+                if (found & (1u << lane)) {
+                    shares.append(work.share(nonce + lane, htobe64(*(uint64_t*)&results[lane * 32])));
+                }
+            }
         }
 
-        nonce++;
-        memcpy(header + 76, &nonce, 4);
+        batch.first += lanes;
     }
+    // a difficulty change keeps the scheduler, the next snapshot hashes what is left of the batch
+    nonces.give_back(index, batch);
 }
 
-void dyn_miner::start_cpu(uint32_t index) {
+void dyn_miner::start_cpu(uint32_t cpu) {
 #ifdef __linux__
     cpu_set_t set;
     CPU_ZERO(&set);
-    CPU_SET(index, &set);
+    CPU_SET(cpu, &set);
     if (sched_setaffinity(0, sizeof(set), &set) < 0) printf("sched_setaffinity failed\n");
 #endif
     wait_for_work();
     mempool_t mempool = mempool_t(32 * 32);
+    batch_sizer_t sizer(SHA256Chain32Width(), std::chrono::milliseconds(50));
+    while (true) {
+        cpu_miner(shared_work, shares, gpu_devices + cpu, sizer, mempool);
+    }
+}
+
+void dyn_miner::build_cpu_engine(const work_t& work) {
+    const uint32_t request = ++engine_request;
+    std::thread([this, request, work]() {
+        auto engine = std::make_shared<cpu_engine_t>();
+        engine->str_program = work.str_program;
+        engine->program = compile_program(work.program);
+        engine->program.plan_memgen();
+
+        if (cpu_engine == cpu_engine_kind::threaded) {
+            engine->threaded = threaded_compile(engine->program, SHA256Chain32Width());
+        } else if (cpu_engine == cpu_engine_kind::jit) {
+            // the JIT checks itself on the memory slots of the job
+            program_t resolved = engine->program;
+            resolved.resolve_memgen(work.prev_block_hash, work.merkle_root);
+            engine->jit = jit_compile(resolved, SHA256Chain32Width(), work.prev_block_hash, work.merkle_root);
+        }
+
+        std::unique_lock<std::mutex> _lock(engine_mutex);
+        if (request == engine_request) {
+            shared_work.set_engine(std::move(engine));
+        }
+    }).detach();
+}
+
+// replaces a job whose nonces were all handed out with the same job at the next version bits, the next
+// ntime when they are used up, or the next extranonce2 when ntime reached the end of its window
+void dyn_miner::roll_exhausted_jobs() {
+    uint32_t handled = 0;
+    merkle_roots_t roots{};
     while (true) {
-        cpu_miner(shared_work, shares, index, rand_seed, mempool);
+        shared_work.exhausted_num.wait(handled);
+        handled = shared_work.exhausted_num.load();
+
+        std::unique_lock<std::mutex> _lock(shared_work.publish_mutex);
+        const std::shared_ptr<const work_t> snapshot = shared_work.snapshot();
+        if (snapshot->num != handled) continue; // replaced meanwhile
+        shares.stats.exhausted_count++;
+
+        work_t work = *snapshot;
+        if (work.has_next_version()) {
+            work.roll_version();
+            printf("All nonces of job %s are hashed, moving to version bits %08x\n", work.job_id.c_str(),
+              work.version_bits);
+        } else if (work.has_next_ntime()) {
+            work.roll_ntime();
+            printf("All nonces of job %s are hashed, moving to ntime %s\n", work.job_id.c_str(),
+              work.hex_ntime.c_str());
+        } else if (work.has_next_extranonce2()) {
+            work.roll_extranonce2(roots);
+            printf("All nonces of job %s are hashed, moving to extranonce2 %s\n", work.job_id.c_str(),
+              work.hex_extranonce2().c_str());
+#ifdef GPU_MINER
+            if (gpu_devices != 0) gpu_program.load_byte_code(work);
+#endif
+        } else {
+            printf("All nonces of job %s are hashed, waiting for the next job\n", work.job_id.c_str());
+            continue;
+        }
+        work.nonces = std::make_shared<nonce_scheduler_t>(nonces);
+        shared_work.publish(std::move(work));
     }
 }
 
-void dyn_miner::set_job(const json& msg, miner_device device) {
-    std::unique_lock<std::shared_mutex> _lock(shared_work.mutex);
+void dyn_miner::set_job(const json& msg) {
+    // the threads keep hashing the current snapshot while the next job is built
+    work_t work = *shared_work.snapshot();
     const std::vector<json>& params = msg["params"];
 
-    work_t& work = shared_work.work;
     work.job_id = params[0];                            // job->id
     const std::string& hex_prev_block_hash = params[1]; // templ->prevhash_be
     hex2bin((unsigned char*)(work.prev_block_hash), hex_prev_block_hash.c_str(), 32);
 
-    const std::string& coinb1 = params[2]; // templ->coinb1
-    const std::string& coinb2 = params[3]; // templ->coinb2
-    const std::string& nbits = params[6];  // templ->nbits
-    work.hex_ntime = params[7];            // templ->ntime
+    auto coinbase = std::make_shared<coinbase_t>();
+    coinbase->coinb1 = hex2bytes(params[2]); // templ->coinb1
+    coinbase->coinb2 = hex2bytes(params[3]); // templ->coinb2
+    const std::string& nbits = params[6];    // templ->nbits
+    work.hex_ntime = params[7];              // templ->ntime
+
+    // merkle branches, lowest first
+    for (const json& hex_branch : params[4]) {
+        std::array<unsigned char, 32>& branch = coinbase->merkle_branch.emplace_back();
+        hex2bin(branch.data(), hex_branch.get<std::string>().c_str(), 32);
+    }
+    coinbase->extranonce1 = extranonce1;
+    coinbase->extranonce2_size = extranonce2_size;
+    work.coinbase = std::move(coinbase);
+    work.extranonce2 = 0;
 
     // set work program
     const std::string& program = params[8];
 
-    unsigned char coinbase[4 * 1024] = {0};
-    hex2bin(coinbase, coinb1.c_str(), coinb1.size());
-    hex2bin(coinbase + (coinb1.size() / 2), coinb2.c_str(), coinb2.size());
-    size_t coinbase_size = (coinb1.size() + coinb2.size()) / 2;
-
     uint32_t ntime{};
     if (8 >= work.hex_ntime.size()) {
         hex2bin((unsigned char*)(&ntime), work.hex_ntime.c_str(), 4);
@@ -154,24 +392,15 @@ void dyn_miner::set_job(const json& msg, miner_device device) {
     }
 
     // Version
-    work.native_data[0] = 0x40;
-    work.native_data[1] = 0x00;
-    work.native_data[2] = 0x00;
-    work.native_data[3] = 0x00;
+    work.version_mask = version_mask;
+    work.version_bits = 0;
+    work.set_version();
 
     memcpy(work.native_data + 4, work.prev_block_hash, 32);
-
-    sha256d((unsigned char*)work.merkle_root, coinbase, coinbase_size);
-    memcpy(work.native_data + 36, work.merkle_root, 32);
-
-    // reverse merkle root...why?  because bitcoin
-    for (int i = 0; i < 16; i++) {
-        unsigned char tmp = work.merkle_root[i];
-        work.merkle_root[i] = work.merkle_root[31 - i];
-        work.merkle_root[31 - i] = tmp;
-    }
-
     memcpy(work.native_data + 68, &ntime, 4);
+    work.ntime = ntime;
+    work.ntime_roll = 0;
+    work.ntime_window = ntime_window;
 
     unsigned char bits[8];
     hex2bin(bits, nbits.data(), nbits.size());
@@ -180,14 +409,21 @@ void dyn_miner::set_job(const json& msg, miner_device device) {
     memcpy(work.native_data + 74, &bits[1], 1);
     memcpy(work.native_data + 75, &bits[0], 1);
 
+    work.set_merkle_root();
+
     // set work program
-    [[maybe_unused]] const bool init_gpu = work.set_program(program);
+    const bool program_changed = work.set_program(program);
+    if (cpu_threads != 0 && program_changed) {
+        build_cpu_engine(work);
+    }
+    // the extranonce2 roller publishes and loads GPU byte code too
+    std::unique_lock<std::mutex> _lock(shared_work.publish_mutex);
 #ifdef GPU_MINER
 
     
-    if (device == miner_device::GPU) {
-        if (init_gpu || gpu_program.kernel.kernel == NULL) {
-            gpu_program.kernel.initOpenCL(gpu_platform_id, compute_units, work.program);
+    if (gpu_devices != 0) {
+        if (program_changed) {
+            gpu_program.build_program_kernels(work);
         }
         gpu_program.load_byte_code(work);
     }
@@ -195,8 +431,11 @@ void dyn_miner::set_job(const json& msg, miner_device device) {
 
 #endif
 
+    // workers take their nonces from a fresh scheduler
+    work.nonces = std::make_shared<nonce_scheduler_t>(nonces);
+
     // set work number for reloading
-    work.num = ++shared_work.num;
+    shared_work.publish(std::move(work));
 }
 
 
@@ -215,6 +454,8 @@ int main(int argc, char* argv[]) {
     printf("Version %s, Dec 27, 2021\n", minerVersion);
     printf("*******************************************************************\n");
 
+    printf("SHA256 implementation: %s\n", SHA256AutoDetect().c_str());
+
     dyn_miner miner{};
 
 #ifdef GPU_MINER
@@ -222,9 +463,9 @@ int main(int argc, char* argv[]) {
     printf("\n");
 #endif
 
-    if (argc != 9) {
+    if (argc < 9) {
         printf("usage: dyn_miner <RPC host> <RPC port> <RPC username> <RPC password> <CPU|GPU> "
-               "<num CPU threads|num GPU compute units> <gpu platform id>\n\n");
+               "<num CPU threads|num GPU compute units> <gpu platform id> <local work size> [options]\n\n");
         printf("EXAMPLE:\n");
         printf("    dyn_miner testnet1.dynamocoin.org 6433 user password CPU 4 0\n");
         printf("    dyn_miner testnet1.dynamocoin.org 6433 user password GPU 1000 0\n");
@@ -233,6 +474,17 @@ int main(int argc, char* argv[]) {
         printf("In GPU mode, the program will create N number of compute units.\n");
         printf("platform ID (starts at 0) is for multi GPU systems.  Ignored for CPU.\n");
         printf("pool mode enables use with dyn miner pool, solo is for standalone mining.\n");
+        printf("\n");
+        printf("OPTIONS:\n");
+        printf("    --engine=jit|threaded|interpreter  how CPU threads run programs (default jit)\n");
+        printf("    --cpu-threads=N                    in GPU mode also mine on N CPU threads\n");
+        printf("    --version-rolling                  roll header version bits (BIP310) if the pool allows it\n");
+        printf("    --ntime-roll=SECONDS               roll ntime up to SECONDS past the job's (default 0, off)\n");
+#ifdef GPU_MINER
+        printf("    --kernel-cache=DIR                 keep built OpenCL kernels in DIR (default kernel-cache, empty off)\n");
+        printf("    --opencl-devices=gpu|cpu|all       OpenCL device types mined on in GPU mode (default gpu)\n");
+        printf("    --kernel-source=FILE               build the OpenCL kernel from FILE instead of the built-in one\n");
+#endif
 
         return -1;
     }
@@ -248,42 +500,96 @@ int main(int argc, char* argv[]) {
 
     miner.local_work_size = atoi(argv[8]);
 
+    for (int i = 9; i < argc; i++) {
+        const std::string option = argv[i];
+        if (option.rfind("--cpu-threads=", 0) == 0) {
+            miner.cpu_threads = atoi(option.c_str() + strlen("--cpu-threads="));
+        } else if (option == "--engine=jit") {
+            miner.cpu_engine = cpu_engine_kind::jit;
+        } else if (option == "--engine=threaded") {
+            miner.cpu_engine = cpu_engine_kind::threaded;
+        } else if (option.rfind("--ntime-roll=", 0) == 0) {
+            miner.ntime_window = atoi(option.c_str() + strlen("--ntime-roll="));
+        } else if (option == "--version-rolling") {
+            miner.version_rolling = true;
+        } else if (option == "--engine=interpreter") {
+            miner.cpu_engine = cpu_engine_kind::interpreter;
+#ifdef GPU_MINER
+        } else if (option.rfind("--kernel-cache=", 0) == 0) {
+            miner.gpu_program.kernel.kernelCacheDir = option.substr(strlen("--kernel-cache="));
+        } else if (option.rfind("--kernel-source=", 0) == 0) {
+            const std::string path = option.substr(strlen("--kernel-source="));
+            if (!miner.gpu_program.kernel.readKernelSource(path)) {
+                printf("Cannot read kernel source %s\n", path.c_str());
+                return -1;
+            }
+        } else if (option == "--opencl-devices=gpu") {
+            miner.gpu_program.kernel.deviceType = CL_DEVICE_TYPE_GPU;
+        } else if (option == "--opencl-devices=cpu") {
+            miner.gpu_program.kernel.deviceType = CL_DEVICE_TYPE_CPU;
+        } else if (option == "--opencl-devices=all") {
+            miner.gpu_program.kernel.deviceType = CL_DEVICE_TYPE_ALL;
+#endif
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
     if ((toupper(argv[5][0]) != 'C') && (toupper(argv[5][0]) != 'G')) {
         printf("Miner type must be CPU or GPU");
     }
     miner_device device = toupper(argv[5][0]) == 'C' ? miner_device::CPU : miner_device::GPU;
 
     if (device == miner_device::CPU) {
-        for (uint32_t i = 0; i < miner.compute_units; i++) {
-            std::thread([i, &miner]() { miner.start_cpu(i); }).detach();
-        }
+        miner.cpu_threads = miner.compute_units;
     } else if (device == miner_device::GPU) {
 #ifdef GPU_MINER
-        uint32_t devices = miner.gpu_program.kernel.numOpenCLDevices;
-        if (devices == 0) {
-            printf("No GPU devices detected.\n");
+        // contexts, queues and kernels are set up once, each program only reloads the program buffer
+        miner.gpu_program.kernel.initOpenCL(miner.gpu_platform_id);
+        miner.gpu_devices = miner.gpu_program.kernel.numOpenCLDevices;
+        if (miner.gpu_devices == 0) {
+            printf("No OpenCL devices of the selected type detected.\n");
             return -1;
         }
-        printf("Starting work on %d devices with %d compute units.\n", devices, miner.compute_units);
-        for (uint32_t i = 0; i < devices; i++) {
-            std::thread([i, &miner]() { miner.start_gpu(i); }).detach();
-        }
+        printf("Starting work on %d devices with %d compute units.\n", miner.gpu_devices, miner.compute_units);
 #else
         printf("Not compiled with GPU support.\n");
         return -1;
 #endif
     }
 
+    // GPUs and CPU threads share the nonces of a job, see `nonce_scheduler_t`
+    miner.shares.stats.set_workers(miner.gpu_devices, miner.cpu_threads);
+    miner.nonces.workers = miner.gpu_devices + miner.cpu_threads;
+#ifdef GPU_MINER
+    for (uint32_t i = 0; i < miner.gpu_devices; i++) {
+        std::thread([i, &miner]() { miner.start_gpu(i); }).detach();
+    }
+#endif
+    for (uint32_t i = 0; i < miner.cpu_threads; i++) {
+        std::thread([i, &miner]() { miner.start_cpu(i); }).detach();
+    }
+    std::thread([&miner]() { miner.roll_exhausted_jobs(); }).detach();
+
     // Start hashrate reporter thread
     std::thread([&miner]() {
         miner.wait_for_work();
         time_t start;
         time(&start);
-        while (true) {
+        std::vector<uint64_t> worker_counts(miner.shares.stats.worker_count);
+        time_t workers_since = start;
+        for (uint32_t report = 1;; report++) {
             std::this_thread::sleep_for(std::chrono::seconds(3));
             time_t now;
             time(&now);
             output_stats(now, start, miner.shares.stats);
+            // rates of each thread or device every 30 seconds
+            if (report % 10 == 0) {
+                output_worker_stats(now - workers_since, miner.shares.stats, worker_counts);
+                output_switch_latency(miner.shares.stats);
+                workers_since = now;
+            }
         }
     }).detach();
 
@@ -328,14 +634,36 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        // send authorization message
         char buf[CBSIZE] = {0};
+        miner.extranonce1.clear();
+        miner.extranonce2_size = 0;
+        miner.version_mask = 0;
 
 #define CHECKED_WRITE(fd, FMT, ...)                                                                                    \
     sprintf(buf, FMT, __VA_ARGS__);                                                                                    \
     DEBUG_LOG("> %s\n", buf);                                                                                          \
     if (write(fd, buf, strlen(buf)) < strlen(buf))
 
+        // ask for version rolling if wanted, subscribe for the extranonces, then authorize
+        if (miner.version_rolling) {
+            CHECKED_WRITE(
+              cbuf.fd,
+              "{\"params\": [[\"version-rolling\"], {\"version-rolling.mask\": \"ffffffff\", "
+              "\"version-rolling.min-bit-count\": %d}], \"id\": \"configure\", \"method\": \"mining.configure\"}",
+              2) {
+                printf("Failed to configure version rolling\n");
+                continue;
+            }
+        }
+
+        CHECKED_WRITE(
+          cbuf.fd,
+          "{\"params\": [\"dyn_miner/%s\"], \"id\": \"subscribe\", \"method\": \"mining.subscribe\"}",
+          minerVersion) {
+            printf("Failed to subscribe\n");
+            continue;
+        }
+
         CHECKED_WRITE(
           cbuf.fd,
           "{\"params\": [\"%s\", \"%s\"], \"id\": \"auth\", \"method\": \"mining.authorize\"}",
@@ -358,18 +686,25 @@ int main(int argc, char* argv[]) {
                 std::optional<share_t> share_opt = std::nullopt;
                 while ((share_opt = miner.shares.pop())) {
                     const share_t share = share_opt.value();
-                    if (miner.shared_work != share.job_num) {
+                    // rolls and difficulty changes publish new snapshots of the same pool job, a share is
+                    // only stale once a mining.notify replaced its job_id
+                    const std::shared_ptr<const work_t> work = miner.shared_work.find(share.job_num);
+                    if (!work || work->job_id != miner.shared_work.snapshot()->job_id) {
                         DEBUG_LOG("Stale share for job %d\n", share.job_num);
                         continue;
                     }
+                    char version_bits[16] = "";
+                    if (work->version_mask != 0) sprintf(version_bits, ", \"%08x\"", work->version_bits);
                     CHECKED_WRITE(
                       fd,
-                      "{\"params\": [\"%s\", \"%s\", \"\", \"%s\", \"%s\"], \"id\": \"%d\", "
+                      "{\"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"%s], \"id\": \"%d\", "
                       "\"method\": \"mining.submit\"}",
                       user,
-                      share.job_id.c_str(),
-                      share.hex_ntime.c_str(),
-                      makeHex((unsigned char*)share.nonce, 4).c_str(),
+                      work->job_id.c_str(),
+                      work->hex_extranonce2().c_str(),
+                      work->hex_ntime.c_str(),
+                      makeHex((unsigned char*)&share.nonce, 4).c_str(),
+                      version_bits,
                       rpc_id++) {
                         printf("Writing failed. Connection closed.\n");
                         return;
@@ -388,7 +723,13 @@ int main(int argc, char* argv[]) {
             if (id.is_null()) {
                 const std::string& method = msg["method"];
                 if (method == "mining.notify") {
-                    miner.set_job(msg, device);
+                    miner.set_job(msg);
+                } else if (method == "mining.set_version_mask") {
+                    const std::vector<json>& params = msg["params"];
+                    miner.set_version_mask(params[0]);
+                } else if (method == "mining.set_extranonce") {
+                    const std::vector<json>& params = msg["params"];
+                    miner.set_extranonce(params[0], params[1]);
                 } else if (method == "mining.set_difficulty") {
                     const std::vector<double>& params = msg["params"];
                     const double diff = params[0];
@@ -398,7 +739,22 @@ int main(int argc, char* argv[]) {
                 }
             } else {
                 const std::string& resp = id;
-                if (resp == "auth") {
+                if (resp == "configure") {
+                    const json& result = msg["result"];
+                    if (result.is_object() && result.value("version-rolling", false)) {
+                        miner.set_version_mask(result.value("version-rolling.mask", "0"));
+                    } else {
+                        printf("Pool does not allow version rolling\n");
+                    }
+                } else if (resp == "subscribe") {
+                    // [subscriptions, extranonce1, extranonce2 size]
+                    const json& result = msg["result"];
+                    if (result.is_array() && result.size() >= 3) {
+                        miner.set_extranonce(result[1], result[2]);
+                    } else {
+                        printf("Subscription failed, mining without extranonce2\n");
+                    }
+                } else if (resp == "auth") {
                     const bool result = msg["result"];
                     if (!result) {
                         printf("Failed authentication as %s\n", rpc.user);
@@ -1,4 +1,8 @@
-#ifndef uint32_t
+#pragma once
+
+// source of the OpenCL kernels, `--kernel-source` builds a file instead (see `CDynGPUKernel::readKernelSource`);
+// MSVC caps a string literal piece at 16K bytes, split at a function boundary
+static const char dyn_miner_cl[] = R"CLC(#ifndef uint32_t
 #define uint32_t unsigned int
 #endif
 
@@ -10,6 +14,7 @@
 #define mod(x,y) ((x)-((x)/(y)*(y)))
 #define shr32(x,n) ((x) >> (n))
 #define rotl32(a,n) rotate ((a), (n))
+#define swap32(x) (as_uint (as_uchar4 (x).s3210))
 
 #define S0(x) (rotl32 ((x), 25u) ^ rotl32 ((x), 14u) ^ shr32 ((x),  3u))
 #define S1(x) (rotl32 ((x), 15u) ^ rotl32 ((x), 13u) ^ shr32 ((x), 10u))
@@ -387,13 +392,15 @@ static inline uint CLZz(uint x)
 
 
 
-__kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __global uint* hostHeader) {
+)CLC"
+R"CLC(// found[0] counts the hashes that meet shareTarget, the first maxFound of them follow as
+// { nonce, high and low word of the first 8 bytes of the hash read big-endian }
+__kernel void dyn_hash (__global uint* byteCode, __global uint* found, __global uint* hostHeader, ulong shareTarget, uint maxFound) {
     
     int computeUnitID = get_global_id(0);
 
-    __global uint* hostHashResult = &hashResult[computeUnitID * 8];
-
-    uint myMemGen[8];
+    // entry of the memory pool READMEM MERKLE and READMEM HASHPREV read
+    uint myMemGen[2][8] = {{0}};
     unsigned char myScratch[32];
     uint myHeader[20];
     uint myHashResult[8];
@@ -423,14 +430,8 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
 
         uint linePtr = 0;
         uint done = 0;
-        uint currentMemSize = 0;
         uint instruction = 0;
 
-        uint firstMemgen = byteCode[52];
-        uint secondMemgen = byteCode[65];
-        uint memgenCount = 0;
-        uint numToGen;
-
         while (done == 0) {
 
             if (byteCode[linePtr] == HASHOP_ADD) {
@@ -468,36 +469,34 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
 
 
             else if (byteCode[linePtr] == HASHOP_MEMGEN) {
-                linePtr++;
+                // the host resolves the entries each region reads and stops the chain after the last one
+                // when nothing uses the end of the chain, see `executeAssembleByteCode`
+                uint slotMerkle = byteCode[linePtr+2];
+                uint slotPrev = byteCode[linePtr+3];
+                uint hashCount = byteCode[linePtr+4];
 
-                currentMemSize = byteCode[linePtr];
-               
-                if (memgenCount == 0) {
-                    numToGen = firstMemgen;
-                    memgenCount = 1;
-                }
-                else
-                    numToGen = secondMemgen;
-                numToGen = numToGen % currentMemSize;
-
-                for ( int i = 0; i < currentMemSize; i++) {
+                for ( uint i = 0; i < hashCount; i++) {
                     loadUintHash(myScratch, myHashResult);
                     sha256 (  32, myScratch, myHashResult );
-                    if ( i == numToGen)
+                    if ( i == slotMerkle)
                         for ( int j = 0; j < 8; j++)
-                            myMemGen[j] = myHashResult[j];
+                            myMemGen[0][j] = myHashResult[j];
+                    if ( i == slotPrev)
+                        for ( int j = 0; j < 8; j++)
+                            myMemGen[1][j] = myHashResult[j];
                 }
-                
-            
-                linePtr++;
+
+                linePtr += 5;
             }
 
 
             else if (byteCode[linePtr] == HASHOP_MEMADD) {
                 linePtr++;
                 
-                for ( int j = 0; j < 8; j++)
-                    myMemGen[j] += byteCode[linePtr+j];
+                for ( int j = 0; j < 8; j++) {
+                    myMemGen[0][j] += byteCode[linePtr+j];
+                    myMemGen[1][j] += byteCode[linePtr+j];
+                }
             
                 linePtr += 8;
             }
@@ -506,8 +505,10 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
             else if (byteCode[linePtr] == HASHOP_MEMXOR) {
                 linePtr++;
             
-                for ( int j = 0; j < 8; j++)
-                    myMemGen[j] ^= byteCode[linePtr+j];
+                for ( int j = 0; j < 8; j++) {
+                    myMemGen[0][j] ^= byteCode[linePtr+j];
+                    myMemGen[1][j] ^= byteCode[linePtr+j];
+                }
             
                 linePtr += 8;
             }
@@ -515,8 +516,10 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
 
             else if (byteCode[linePtr] == HASHOP_MEM_SELECT) {
                 linePtr++;
+                // 0 for MERKLE, 1 for HASHPREV
+                uint region = byteCode[linePtr];
                 for ( int j = 0; j < 8; j++)
-                    myHashResult[j] = myMemGen[j];
+                    myHashResult[j] = myMemGen[region][j];
                 
                 linePtr++;
             }
@@ -529,7 +532,14 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
         }
 
 
-    for ( int i = 0; i < 8; i++)
-        hostHashResult[i] = myHashResult[i];
+    ulong hash = ((ulong)swap32(myHashResult[0]) << 32) | swap32(myHashResult[1]);
+    if (hash <= shareTarget) {
+        uint slot = atomic_inc(&found[0]);
+        if (slot < maxFound) {
+            found[1 + slot * 3] = nonce;
+            found[2 + slot * 3] = (uint)(hash >> 32);
+            found[3 + slot * 3] = (uint)hash;
+        }
+    }
 
-}
\ No newline at end of file
+})CLC";
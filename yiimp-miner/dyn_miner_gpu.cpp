@@ -1,13 +1,19 @@
 #include "dyn_miner_gpu.h"
 
+#include "core/sha256.h"
+#include "dyn_miner_cl.h"
 #include "dyn_ops.h"
 #include "dyn_stratum.h"
 #include "util/hex.h"
-#include "util/rand.h"
+#include "util/nonce.h"
 #include "util/stats.h"
 
+#include <filesystem>
+#include <fstream>
 #include <iterator>
+#include <random>
 #include <sstream>
+#include <thread>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -26,93 +32,97 @@
 #include <unistd.h>
 #endif
 
-static std::vector<uint32_t> executeAssembleByteCode(
-  uint32_t* largestMemgen, const std::vector<std::string>& program, const char* prevBlockHash, const char* merkleRoot) {
-    std::vector<uint32_t> code;
-
-    int line_ptr = 0;             // program execution line pointer
-    int loop_counter = 0;         // counter for loop execution
-    unsigned int memory_size = 0; // size of current memory pool
-    uint32_t* memPool = NULL;     // memory pool
+// how the ops up to the next MEMGEN use the pool of the MEMGEN at `index`
+struct memgen_reads_t {
+    uint32_t regions = 0;   // bit per `memregion` READMEM reads the pool with
+    bool chain_live = true; // the last hash of the chain is hashed further or is the result
+};
+
+static memgen_reads_t memgenReads(const program_ir_t& ir, size_t index) {
+    memgen_reads_t reads{};
+    bool chain_known = false;
+    for (size_t j = index + 1; j < ir.size() && ir[j].op != hashop::MEMGEN; j++) {
+        switch (ir[j].op) {
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::SHA_SINGLE:
+        case hashop::SHA_LOOP:
+            chain_known = true;
+            break;
+        case hashop::MEM_SELECT:
+            if (ir[j].region == memregion::unknown) break;
+            reads.regions |= 1u << static_cast<uint32_t>(ir[j].region);
+            // READMEM replaces the hash before anything used it
+            if (!chain_known) reads.chain_live = false;
+            chain_known = true;
+            break;
+        default:
+            break;
+        }
+    }
+    return reads;
+}
 
-    while (line_ptr < program.size()) {
-        std::istringstream iss(program[line_ptr]);
-        std::vector<std::string> tokens{
-          std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>{}}; // split line into tokens
+// MEMGEN is followed by the pool size, the entries READMEM MERKLE and READMEM HASHPREV read (none if
+// unread) and how many hashes of the chain to run, READMEM by its `memregion`
+static std::vector<uint32_t> executeAssembleByteCode(
+  uint32_t* largestMemgen, const program_ir_t& ir, const char* prevBlockHash, const char* merkleRoot) {
+    constexpr uint32_t noSlot = 0xffffffff;
+    const uint32_t regionWord[2] = {*(uint32_t*)merkleRoot, *(uint32_t*)prevBlockHash};
 
+    std::vector<uint32_t> code;
+    for (size_t i = 0; i < ir.size(); i++) {
+        const ir_op_t& op = ir[i];
+        switch (op.op) {
         // simple ADD and XOR functions with one constant argument
-        if (tokens[0] == "ADD") {
-            uint32_t arg1[8];
-            parseHex(tokens[1], (unsigned char*)arg1);
-            code.push_back(HASHOP_ADD);
-            for (int i = 0; i < 8; i++)
-                code.push_back(arg1[i]);
-        }
-
-        else if (tokens[0] == "XOR") {
-            uint32_t arg1[8];
-            code.push_back(HASHOP_XOR);
-            parseHex(tokens[1], (unsigned char*)arg1);
-            for (int i = 0; i < 8; i++)
-                code.push_back(arg1[i]);
-        }
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::MEMADD:
+        case hashop::MEMXOR:
+            code.push_back(static_cast<uint32_t>(op.op));
+            code.insert(code.end(), op.operand.begin(), op.operand.end());
+            break;
 
         // hash algo which can be optionally repeated several times
-        else if (tokens[0] == "SHA2") {
-            if (tokens.size() == 2) { // includes a loop count
-                loop_counter = atoi(tokens[1].c_str());
+        case hashop::SHA_SINGLE:
+        case hashop::SHA_LOOP:
+            if (op.count == 1) {
+                code.push_back(HASHOP_SHA_SINGLE);
+            } else {
                 code.push_back(HASHOP_SHA_LOOP);
-                code.push_back(loop_counter);
+                code.push_back(op.count);
             }
-
-            else { // just a single run
-                if (tokens[0] == "SHA2") {
-                    code.push_back(HASHOP_SHA_SINGLE);
-                }
+            break;
+
+        // generate a block of memory based on a hashing algo, up to the last entry the program reads
+        case hashop::MEMGEN: {
+            const memgen_reads_t reads = memgenReads(ir, i);
+            uint32_t slots[2] = {noSlot, noSlot};
+            uint32_t hashCount = reads.chain_live ? op.count : 0;
+            for (uint32_t r = 0; r < 2; r++) {
+                if (op.count == 0 || !(reads.regions & (1u << r))) continue;
+                slots[r] = regionWord[r] % op.count;
+                hashCount = std::max(hashCount, slots[r] + 1);
             }
-        }
-
-        // generate a block of memory based on a hashing algo
-        else if (tokens[0] == "MEMGEN") {
-            memory_size = atoi(tokens[2].c_str());
             code.push_back(HASHOP_MEMGEN);
-            code.push_back(memory_size);
-            if (memory_size > *largestMemgen) *largestMemgen = memory_size;
-        }
-
-        // add a constant to every value in the memory block
-        else if (tokens[0] == "MEMADD") {
-            code.push_back(HASHOP_MEMADD);
-            uint32_t arg1[8];
-            parseHex(tokens[1], (unsigned char*)arg1);
-            for (int j = 0; j < 8; j++)
-                code.push_back(arg1[j]);
-        }
-
-        // xor a constant with every value in the memory block
-        else if (tokens[0] == "MEMXOR") {
-            code.push_back(HASHOP_MEMXOR);
-            uint32_t arg1[8];
-            parseHex(tokens[1], (unsigned char*)arg1);
-            for (int j = 0; j < 8; j++)
-                code.push_back(arg1[j]);
+            code.push_back(op.count);
+            code.push_back(slots[0]);
+            code.push_back(slots[1]);
+            code.push_back(hashCount);
+            if (op.count > *largestMemgen) *largestMemgen = op.count;
+            break;
         }
 
         // read a value based on an index into the generated block of memory
-        else if (tokens[0] == "READMEM") {
+        case hashop::MEM_SELECT:
+            if (op.region == memregion::unknown) break;
             code.push_back(HASHOP_MEM_SELECT);
-            if (tokens[1] == "MERKLE") {
-                uint32_t v0 = *(uint32_t*)merkleRoot;
-                code.push_back(v0);
-            }
+            code.push_back(static_cast<uint32_t>(op.region));
+            break;
 
-            else if (tokens[1] == "HASHPREV") {
-                uint32_t v0 = *(uint32_t*)prevBlockHash;
-                code.push_back(v0);
-            }
+        default:
+            break;
         }
-
-        line_ptr++;
     }
 
     code.push_back(HASHOP_END);
@@ -120,38 +130,206 @@ static std::vector<uint32_t> executeAssembleByteCode(
     return code;
 }
 
-inline CDynProgramGPU::byte_code_t vector_to_contiguous(std::vector<uint32_t> code) {
-    uint32_t* result = (uint32_t*)malloc(sizeof(uint32_t) * code.size());
-    for (int i = 0; i < code.size(); i++)
-        result[i] = code.at(i);
-    return {.ptr = CDynProgramGPU::byte_code_ptr(result), .size = sizeof(uint32_t) * code.size()};
+static void appendSha(std::ostringstream& out, const char* indent) {
+    out << indent << "loadUintHash(myScratch, myHashResult);\n";
+    out << indent << "sha256(32, myScratch, myHashResult);\n";
 }
 
-void CDynProgramGPU::load_byte_code(const work_t& work) {
-    if (strcmp(work.prev_block_hash, prev_block_hash) == 0 && strcmp(work.merkle_root, merkle_root) == 0) {
-        return;
+// OpenCL C of a kernel `dyn_hash_program` that runs `program` with operands and counts as literals, it takes
+// the arguments of `dyn_hash` and uses the helpers of dyn_miner.cl; empty for programs it does not cover
+static std::string generateProgramKernel(const program_t& program) {
+    const program_ir_t ir = bytecode_to_ir(program);
+
+    // a MEMGEN that does not hash leaves older entries readable and the generated kernel only keeps the entries
+    // READMEM reads, so no kernel is generated; the devices keep running the program on the interpreter kernel
+    // `dyn_hash`, which handles every MEMGEN itself
+    for (const ir_op_t& op : ir)
+        if (op.op == hashop::MEMGEN && (op.memgen_op != hashop::SHA_SINGLE || op.count == 0)) return {};
+
+    // literals are written in hex, indices are below 10 and read the same
+    std::ostringstream out;
+    out << std::hex;
+    out << "__kernel void dyn_hash_program (__global uint* byteCode, __global uint* found, __global uint* hostHeader, "
+           "ulong shareTarget, uint maxFound) {\n"
+           "    int computeUnitID = get_global_id(0);\n"
+           "    unsigned char myScratch[32];\n"
+           "    uint myHeader[20];\n"
+           "    uint myHashResult[8];\n"
+           "    // entry of the memory pool each READMEM region reads, indexed by `memregion`\n"
+           "    uint myMemGen[2][8];\n"
+           "    // first words of the merkle root and the previous block hash, they select the entries\n"
+           "    uint regionWord[2] = { swap32(hostHeader[16]), hostHeader[1] };\n"
+           "    uint nonce = hostHeader[19] + computeUnitID;\n"
+           "    for (int i = 0; i < 20; i++)\n"
+           "        myHeader[i] = hostHeader[i];\n"
+           "    myHeader[19] = nonce;\n"
+           "    sha256(80, myHeader, myHashResult);\n";
+
+    bool pool = false;    // a MEMGEN ran
+    uint32_t regions = 0; // regions read from the current pool
+    for (size_t i = 0; i < ir.size(); i++) {
+        const ir_op_t& op = ir[i];
+        switch (op.op) {
+        case hashop::ADD:
+        case hashop::XOR:
+            for (uint32_t k = 0; k < 8; k++)
+                out << "    myHashResult[" << k << "] " << (op.op == hashop::ADD ? "+=" : "^=") << " 0x" << op.operand[k]
+                    << "u;\n";
+            break;
+        case hashop::SHA_SINGLE:
+        case hashop::SHA_LOOP:
+            if (op.count == 1) {
+                appendSha(out, "    ");
+            } else if (op.count != 0) {
+                out << "    for (uint i = 0; i < 0x" << op.count << "u; i++) {\n";
+                appendSha(out, "        ");
+                out << "    }\n";
+            }
+            break;
+        case hashop::MEMGEN: {
+            // only the entries READMEM reads before the next MEMGEN are kept, the chain stops at the last
+            // of them unless its end is used
+            const memgen_reads_t reads = memgenReads(ir, i);
+            regions = reads.regions;
+            pool = true;
+            if (!reads.chain_live && regions == 0) break;
+
+            out << "    {\n";
+            for (uint32_t r = 0; r < 2; r++)
+                if (regions & (1u << r))
+                    out << "        uint slot" << r << " = regionWord[" << r << "] % 0x" << op.count << "u;\n";
+            if (reads.chain_live)
+                out << "        uint hashCount = 0x" << op.count << "u;\n";
+            else if (regions == 3)
+                out << "        uint hashCount = max(slot0, slot1) + 1u;\n";
+            else
+                out << "        uint hashCount = slot" << (regions == 1 ? 0 : 1) << " + 1u;\n";
+            out << "        for (uint i = 0; i < hashCount; i++) {\n";
+            appendSha(out, "            ");
+            for (uint32_t r = 0; r < 2; r++)
+                if (regions & (1u << r))
+                    out << "            if (i == slot" << r << ")\n"
+                        << "                for (int j = 0; j < 8; j++)\n"
+                        << "                    myMemGen[" << r << "][j] = myHashResult[j];\n";
+            out << "        }\n"
+                   "    }\n";
+            break;
+        }
+        case hashop::MEMADD:
+        case hashop::MEMXOR:
+            for (uint32_t r = 0; r < 2; r++)
+                if (regions & (1u << r))
+                    for (uint32_t k = 0; k < 8; k++)
+                        out << "    myMemGen[" << r << "][" << k << "] " << (op.op == hashop::MEMADD ? "+=" : "^=")
+                            << " 0x" << op.operand[k] << "u;\n";
+            break;
+        case hashop::MEM_SELECT:
+            if (op.region == memregion::unknown) break;
+            // READMEM without a pool has nothing to read
+            if (!pool) return {};
+            out << "    for (int j = 0; j < 8; j++)\n"
+                   "        myHashResult[j] = myMemGen["
+                << static_cast<uint32_t>(op.region) << "][j];\n";
+            break;
+        default:
+            break;
+        }
     }
-    // TODO: buffer resizing
-    uint32_t largestMemgen{};
-    std::vector<uint32_t> byteCode = executeAssembleByteCode(
-      &largestMemgen, work.program, work.prev_block_hash, work.merkle_root); // only calling to get largestMemgen
-    byte_code = vector_to_contiguous(byteCode);
-    memcpy(prev_block_hash, work.prev_block_hash, 32);
-    memcpy(merkle_root, work.merkle_root, 32);
+
+    out << "    ulong hash = ((ulong)swap32(myHashResult[0]) << 32) | swap32(myHashResult[1]);\n"
+           "    if (hash <= shareTarget) {\n"
+           "        uint slot = atomic_inc(&found[0]);\n"
+           "        if (slot < maxFound) {\n"
+           "            found[1 + slot * 3] = nonce;\n"
+           "            found[2 + slot * 3] = (uint)(hash >> 32);\n"
+           "            found[3 + slot * 3] = (uint)hash;\n"
+           "        }\n"
+           "    }\n"
+           "}\n";
+    return out.str();
+}
+
+void CDynProgramGPU::build_program_kernels(const work_t& work) {
+    uint32_t request;
+    {
+        std::unique_lock<std::mutex> _lock(program_kernels_mutex);
+        request = ++program_kernels_request;
+        // kernels of an older program are of no use to the devices any more
+        program_kernels.store(nullptr);
+    }
+
+    // the contexts and devices the build reads are set up once by `initOpenCL` before the first job
+    std::thread([this, request, str_program = work.str_program, program = work.program]() {
+        const std::string generated = generateProgramKernel(compile_program(program));
+        if (generated.empty()) return;
+        const std::string source = kernel.kernelSource + "\n" + generated;
+
+        auto built = std::make_shared<program_kernels_t>();
+        built->str_program = str_program;
+        const uint32_t depth = CDynGPUKernel::pipelineDepth;
+        for (uint32_t i = 0; i < kernel.numOpenCLDevices; i++) {
+            // a program rarely comes back after a restart, its kernels are not worth a file in the cache
+            cl_program clProgram = kernel.buildProgram(i, source, false);
+            if (clProgram == NULL) {
+                printf("Generated kernel failed to build, GPUs stay on the interpreter kernel\n");
+                return;
+            }
+            for (uint32_t slot = 0; slot < depth; slot++) {
+                cl_int returnVal;
+                cl_kernel clKernel = clCreateKernel(clProgram, "dyn_hash_program", &returnVal);
+                if (clKernel == NULL || returnVal != CL_SUCCESS) {
+                    printf("Generated kernel failed to load (%d), GPUs stay on the interpreter kernel\n", returnVal);
+                    clReleaseProgram(clProgram);
+                    return;
+                }
+                built->kernels.push_back(clKernel);
+            }
+            clReleaseProgram(clProgram);
+        }
+
+        std::unique_lock<std::mutex> _lock(program_kernels_mutex);
+        if (request == program_kernels_request) {
+            program_kernels.store(std::move(built));
+            program_kernels_num++;
+        }
+    }).detach();
+}
+
+void CDynProgramGPU::load_byte_code(work_t& work) {
+    const bool program_changed = work.str_program != str_program;
+    if (program_changed || memcmp(work.prev_block_hash, prev_block_hash, 32) != 0 ||
+        memcmp(work.merkle_root, merkle_root, 32) != 0) {
+        if (program_changed) {
+            program_ir = bytecode_to_ir(compile_program(work.program));
+            str_program = work.str_program;
+        }
+        uint32_t largestMemgen{};
+        byte_code = std::make_shared<const std::vector<uint32_t>>(
+          executeAssembleByteCode(&largestMemgen, program_ir, work.prev_block_hash, work.merkle_root));
+        memcpy(prev_block_hash, work.prev_block_hash, 32);
+        memcpy(merkle_root, work.merkle_root, 32);
+    }
+    // the GPU threads upload the byte code of the snapshot they run, see `start_miner`
+    work.gpu_byte_code = byte_code;
 }
 
 CDynGPUKernel::CDynGPUKernel() {
     openCLDevices = (cl_device_id*)malloc(16 * sizeof(cl_device_id));
 
-    kernel = (cl_kernel*)malloc(16 * sizeof(cl_kernel));
+    kernel = (cl_kernel*)malloc(16 * pipelineDepth * sizeof(cl_kernel));
     command_queue = (cl_command_queue*)malloc(16 * sizeof(cl_command_queue));
+    hit_queue = (cl_command_queue*)malloc(16 * sizeof(cl_command_queue));
 
-    clGPUHashResultBuffer = (cl_mem*)malloc(16 * sizeof(cl_mem));
-    buffHashResult = (uint32_t**)malloc(16 * sizeof(uint32_t*));
+    maxFound = (uint32_t*)malloc(16 * sizeof(uint32_t));
+    foundBuffSize = (uint32_t*)malloc(16 * sizeof(uint32_t));
+    clGPUFoundBuffer = (cl_mem*)malloc(16 * pipelineDepth * sizeof(cl_mem));
+    buffFound = (uint32_t**)malloc(16 * pipelineDepth * sizeof(uint32_t*));
 
-    clGPUHeaderBuffer = (cl_mem*)malloc(16 * sizeof(cl_mem));
-    buffHeader = (unsigned char**)malloc(16 * sizeof(char*));
+    clGPUHeaderBuffer = (cl_mem*)malloc(16 * pipelineDepth * sizeof(cl_mem));
+    buffHeader = (unsigned char**)malloc(16 * pipelineDepth * sizeof(char*));
     clGPUProgramBuffer = (cl_mem*)malloc(16 * sizeof(cl_mem));
+    programBuffSize = (size_t*)malloc(16 * sizeof(size_t));
+    context = (cl_context*)malloc(16 * sizeof(cl_context));
     platform_id = (cl_platform_id*)malloc(16 * sizeof(cl_platform_id));
 }
 
@@ -167,42 +345,185 @@ void CDynGPUKernel::print() {
     returnVal = clGetPlatformIDs(16, platform_id, &ret_num_platforms);
 
     if (ret_num_platforms > 0) {
-        printf("OpenCL GPUs detected:\n");
+        printf("OpenCL devices detected:\n");
     } else {
         printf("No OpenCL platforms detected.\n");
     }
 
     for (uint32_t i = 0; i < ret_num_platforms; i++) {
-        returnVal = clGetDeviceIDs(platform_id[i], CL_DEVICE_TYPE_GPU, 16, device_id, &numOpenCLDevices);
+        // every type, `--opencl-devices` picks the ones mined on
+        returnVal = clGetDeviceIDs(platform_id[i], CL_DEVICE_TYPE_ALL, 16, device_id, &numOpenCLDevices);
         for (uint32_t j = 0; j < numOpenCLDevices; j++) {
+            cl_device_type type;
+            returnVal = clGetDeviceInfo(device_id[j], CL_DEVICE_TYPE, sizeof(type), &type, &sizeRet);
             returnVal = clGetDeviceInfo(
               device_id[j], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, &sizeRet);
             returnVal = clGetDeviceInfo(
               device_id[j], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, &sizeRet);
-            printf("platform %d, device %d [memory %lu, compute units %d]\n", i, j, globalMem, computeUnits);
+            printf(
+              "platform %d, device %d [%s, memory %lu, compute units %d]\n",
+              i,
+              j,
+              (type & CL_DEVICE_TYPE_GPU) ? "GPU" : (type & CL_DEVICE_TYPE_CPU) ? "CPU" : "other",
+              globalMem,
+              computeUnits);
         }
     }
 }
 
-void CDynGPUKernel::initOpenCL(int platformID, int computeUnits, const std::vector<std::string>& program) {
+void CDynGPUKernel::sizeFoundBuffers(uint32_t device, uint32_t found) {
+    if (found <= maxFound[device]) return;
+    cl_int returnVal;
+    maxFound[device] = found;
+    foundBuffSize[device] = (1 + found * 3) * sizeof(uint32_t);
+    for (uint32_t slot = 0; slot < pipelineDepth; slot++) {
+        const uint32_t s = device * pipelineDepth + slot;
+        clReleaseMemObject(clGPUFoundBuffer[s]);
+        clGPUFoundBuffer[s] = clCreateBuffer(context[device], CL_MEM_READ_WRITE, foundBuffSize[device], NULL, &returnVal);
+        free(buffFound[s]);
+        buffFound[s] = (uint32_t*)calloc(1, foundBuffSize[device]);
+    }
+}
 
+static std::string deviceInfo(cl_device_id device, cl_device_info param) {
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, NULL, &size);
+    std::string info(size, '\0');
+    clGetDeviceInfo(device, param, size, info.data(), NULL);
+    return info;
+}
 
-    
-    uint32_t largestMemgen = 0;
-    std::vector<uint32_t> byteCode = executeAssembleByteCode(
-      &largestMemgen, program, "0000", "0000"); // only calling to get largestMemgen
-      
+std::string CDynGPUKernel::binaryPath(uint32_t device, const std::string& source) const {
+    // everything the binary depends on, each part with its terminator so parts cannot run into each other
+    const std::string parts[] = {
+      deviceInfo(openCLDevices[device], CL_DEVICE_NAME),
+      deviceInfo(openCLDevices[device], CL_DRIVER_VERSION),
+      buildOptions,
+      source,
+    };
+    CSHA256 key;
+    for (const std::string& part : parts)
+        key.Write((const unsigned char*)part.c_str(), part.size() + 1);
+    unsigned char digest[CSHA256::OUTPUT_SIZE];
+    key.Finalize(digest);
+    return kernelCacheDir + "/" + makeHex(digest, sizeof(digest)) + ".bin";
+}
 
-    CDynProgramGPU::byte_code_t byteCodePtr = vector_to_contiguous(byteCode);
+cl_program CDynGPUKernel::loadBinary(uint32_t device, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return NULL;
+    const std::vector<unsigned char> binary{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    const unsigned char* binaryPtr = binary.data();
+    const size_t binarySize = binary.size();
 
     cl_int returnVal;
-    cl_uint ret_num_platforms;
+    cl_int binaryStatus;
+    cl_program program = clCreateProgramWithBinary(
+      context[device], 1, &openCLDevices[device], &binarySize, &binaryPtr, &binaryStatus, &returnVal);
+    if (returnVal != CL_SUCCESS) return NULL;
+    returnVal = clBuildProgram(program, 1, &openCLDevices[device], buildOptions, NULL, NULL);
+    if (returnVal != CL_SUCCESS) {
+        // left by another driver or cut short, it is rebuilt from source and replaced
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
 
-    cl_context* context = (cl_context*)malloc(16 * sizeof(cl_context));
+void CDynGPUKernel::saveBinary(cl_program program, const std::string& path) {
+    size_t binarySize = 0;
+    clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, NULL);
+    if (binarySize == 0) return;
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char* binaryPtr = binary.data();
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaryPtr), &binaryPtr, NULL) != CL_SUCCESS) return;
+
+    // written aside and renamed, so a miner starting meanwhile never reads half a binary; the name is random
+    // so miners sharing the cache never write the same file
+    std::error_code error;
+    std::filesystem::create_directories(kernelCacheDir, error);
+    std::random_device random;
+    const uint32_t suffix[2] = {random(), random()};
+    const std::string tmpPath = path + "." + makeHex((unsigned char*)suffix, sizeof(suffix)) + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write((const char*)binary.data(), binary.size());
+        if (!file) {
+            printf("Failed to write kernel binary %s\n", tmpPath.c_str());
+            return;
+        }
+    }
+    std::filesystem::rename(tmpPath, path, error);
+    if (error) printf("Failed to write kernel binary %s: %s\n", path.c_str(), error.message().c_str());
+}
+
+bool CDynGPUKernel::readKernelSource(const std::string& path) {
+    FILE* kernelSourceFile = fopen(path.c_str(), "r");
+    if (!kernelSourceFile) return false;
+    fseek(kernelSourceFile, 0, SEEK_END);
+    kernelSource.resize(ftell(kernelSourceFile));
+    fseek(kernelSourceFile, 0, SEEK_SET);
+    kernelSource.resize(fread(kernelSource.data(), 1, kernelSource.size(), kernelSourceFile));
+    fclose(kernelSourceFile);
+    return true;
+}
+
+cl_program CDynGPUKernel::buildProgram(uint32_t device, const std::string& source, bool cache) {
+    const std::string path = !cache || kernelCacheDir.empty() ? std::string() : binaryPath(device, source);
+    if (!path.empty()) {
+        cl_program cached = loadBinary(device, path);
+        if (cached != NULL) return cached;
+    }
+
+    cl_int returnVal;
+    const char* sourcePtr = source.c_str();
+    const size_t sourceLen = source.size();
+
+    // Create kernel program
+    cl_program program = clCreateProgramWithSource(context[device], 1, &sourcePtr, &sourceLen, &returnVal);
+    returnVal = clBuildProgram(program, 1, &openCLDevices[device], buildOptions, NULL, NULL);
+
+    if (returnVal == CL_BUILD_PROGRAM_FAILURE) {
+        // Determine the size of the log
+        size_t log_size;
+        clGetProgramBuildInfo(program, openCLDevices[device], CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+
+        // Allocate memory for the log
+        char* log = (char*)malloc(log_size);
+
+        // Get the log
+        clGetProgramBuildInfo(program, openCLDevices[device], CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+
+        // Print the log
+        printf("\n\n%s\n", log);
+        free(log);
+    }
+    if (returnVal != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+    if (!path.empty()) saveBinary(program, path);
+    return program;
+}
+
+void CDynGPUKernel::loadProgramBuffer(uint32_t device, const void* code, size_t size) {
+    cl_int returnVal;
+    if (size > programBuffSize[device]) {
+        if (clGPUProgramBuffer[device] != NULL) clReleaseMemObject(clGPUProgramBuffer[device]);
+        clGPUProgramBuffer[device] = clCreateBuffer(context[device], CL_MEM_READ_WRITE, size, NULL, &returnVal);
+        programBuffSize[device] = size;
+    }
+    returnVal = clEnqueueWriteBuffer(
+      command_queue[device], clGPUProgramBuffer[device], CL_TRUE, 0, size, code, 0, NULL, NULL);
+}
+
+void CDynGPUKernel::initOpenCL(int platformID) {
+    cl_int returnVal;
+    cl_uint ret_num_platforms;
 
     // Initialize context
     returnVal = clGetPlatformIDs(16, platform_id, &ret_num_platforms);
-    returnVal = clGetDeviceIDs(platform_id[platformID], CL_DEVICE_TYPE_GPU, 16, openCLDevices, &numOpenCLDevices);
+    returnVal = clGetDeviceIDs(platform_id[platformID], deviceType, 16, openCLDevices, &numOpenCLDevices);
     for (uint32_t i = 0; i < numOpenCLDevices; i++) {
         context[i] = clCreateContext(NULL, 1, &openCLDevices[i], NULL, NULL, &returnVal);
 
@@ -238,59 +559,22 @@ void CDynGPUKernel::initOpenCL(int platformID, int computeUnits, const std::vect
 
         // computeUnits = numComputeUnits;
 
-        // Read the kernel source
-        FILE* kernelSourceFile;
-
-        kernelSourceFile = fopen("dyn_miner.cl", "r");
-        if (!kernelSourceFile) {
-            fprintf(stderr, "Failed to load kernel.\n");
-            return;
-        }
-        fseek(kernelSourceFile, 0, SEEK_END);
-        size_t sourceFileLen = ftell(kernelSourceFile) + 1;
-        char* kernelSource = (char*)malloc(sourceFileLen);
-        memset(kernelSource, 0, sourceFileLen);
-        fseek(kernelSourceFile, 0, SEEK_SET);
-        size_t numRead = fread(kernelSource, 1, sourceFileLen, kernelSourceFile);
-        fclose(kernelSourceFile);
-
-        cl_program program;
-
-        // Create kernel program
-        program = clCreateProgramWithSource(
-          context[i], 1, (const char**)&kernelSource, &numRead, &returnVal);
-        returnVal = clBuildProgram(program, 1, &openCLDevices[i], NULL, NULL, NULL);
+        // the built-in kernel source unless `--kernel-source` gave one
+        if (kernelSource.empty()) kernelSource = dyn_miner_cl;
 
-        free(kernelSource);
+        cl_program program = buildProgram(i, kernelSource);
 
-        if (returnVal == CL_BUILD_PROGRAM_FAILURE) {
-            // Determine the size of the log
-            size_t log_size;
-            clGetProgramBuildInfo(program, openCLDevices[i], CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-
-            // Allocate memory for the log
-            char* log = (char*)malloc(log_size);
-
-            // Get the log
-            clGetProgramBuildInfo(program, openCLDevices[i], CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-
-            // Print the log
-            printf("\n\n%s\n", log);
-        }
-
-        kernel[i] = clCreateKernel(program, "dyn_hash", &returnVal);
         command_queue[i] = clCreateCommandQueueWithProperties(context[i], openCLDevices[i], NULL, &returnVal);
+        hit_queue[i] = clCreateCommandQueueWithProperties(context[i], openCLDevices[i], NULL, &returnVal);
 
         // Calculate buffer sizes - mempool, hash result buffer, done flag
         //uint32_t memgenBytes = largestMemgen * 32;
         //uint32_t globalMempoolSize = memgenBytes * computeUnits;
         // TODO - make sure this is less than globalMem
 
-        // Allocate program source buffer and load
-        clGPUProgramBuffer[i] = clCreateBuffer(context[i], CL_MEM_READ_WRITE, byteCodePtr.size, NULL, &returnVal);
-        returnVal = clSetKernelArg(kernel[i], 0, sizeof(cl_mem), (void*)&clGPUProgramBuffer[i]);
-        returnVal = clEnqueueWriteBuffer(
-          command_queue[i], clGPUProgramBuffer[i], CL_TRUE, 0, byteCodePtr.size, byteCodePtr.ptr.get(), 0, NULL, NULL);
+        // the program buffer is sized by the first program loaded, see `loadProgramBuffer`
+        clGPUProgramBuffer[i] = NULL;
+        programBuffSize[i] = 0;
 
         /*
         // Allocate global memory buffer and zero
@@ -306,14 +590,28 @@ void CDynGPUKernel::initOpenCL(int platformID, int computeUnits, const std::vect
         // Size of memgen area - this is the number of 8 uint blocks
         //returnVal = clSetKernelArg(kernel[i], 2, sizeof(largestMemgen), (void*)&largestMemgen);
 
-        // Allocate hash result buffer and zero
-        hashResultSize = computeUnits * 32;
-        clGPUHashResultBuffer[i] = clCreateBuffer(context[i], CL_MEM_READ_WRITE, hashResultSize, NULL, &returnVal);
-        returnVal = clSetKernelArg(kernel[i], 1, sizeof(cl_mem), (void*)&clGPUHashResultBuffer[i]);
-        buffHashResult[i] = (uint32_t*)malloc(hashResultSize);
-        memset(buffHashResult[i], 0, hashResultSize);
-        returnVal = clEnqueueWriteBuffer(
-          command_queue[i], clGPUHashResultBuffer[i], CL_TRUE, 0, hashResultSize, buffHashResult[i], 0, NULL, NULL);
+        maxFound[i] = minFound;
+        foundBuffSize[i] = (1 + maxFound[i] * 3) * sizeof(uint32_t);
+        headerBuffSize = 80;
+        for (uint32_t slot = 0; slot < pipelineDepth; slot++) {
+            const uint32_t s = i * pipelineDepth + slot;
+
+            kernel[s] = clCreateKernel(program, "dyn_hash", &returnVal);
+
+            // Allocate found buffer and zero, hits are counted in its first word
+            clGPUFoundBuffer[s] = clCreateBuffer(context[i], CL_MEM_READ_WRITE, foundBuffSize[i], NULL, &returnVal);
+            buffFound[s] = (uint32_t*)malloc(foundBuffSize[i]);
+            memset(buffFound[s], 0, foundBuffSize[i]);
+            returnVal = clEnqueueWriteBuffer(
+              command_queue[i], clGPUFoundBuffer[s], CL_TRUE, 0, foundBuffSize[i], buffFound[s], 0, NULL, NULL);
+
+            // Allocate header buffer and load
+            clGPUHeaderBuffer[s] = clCreateBuffer(context[i], CL_MEM_READ_WRITE, headerBuffSize, NULL, &returnVal);
+            buffHeader[s] = (unsigned char*)malloc(headerBuffSize);
+            memset(buffHeader[s], 0, headerBuffSize);
+            returnVal = clEnqueueWriteBuffer(
+              command_queue[i], clGPUHeaderBuffer[s], CL_TRUE, 0, headerBuffSize, buffHeader[s], 0, NULL, NULL);
+        }
 
         /*
         //Allocate found flag buffer and zero
@@ -326,14 +624,8 @@ void CDynGPUKernel::initOpenCL(int platformID, int computeUnits, const std::vect
         NULL, NULL);
         */
 
-        // Allocate header buffer and load
-        headerBuffSize =  80;
-        clGPUHeaderBuffer[i] = clCreateBuffer(context[i], CL_MEM_READ_WRITE, headerBuffSize, NULL, &returnVal);
-        returnVal = clSetKernelArg(kernel[i], 2, sizeof(cl_mem), (void*)&clGPUHeaderBuffer[i]);
-        buffHeader[i] = (unsigned char*)malloc(headerBuffSize);
-        memset(buffHeader[i], 0, headerBuffSize);
-        returnVal = clEnqueueWriteBuffer(
-          command_queue[i], clGPUHeaderBuffer[i], CL_TRUE, 0, headerBuffSize, buffHeader[i], 0, NULL, NULL);
+        // the kernels keep the program alive
+        clReleaseProgram(program);
 
         /*
         // Allocate SHA256 scratch buffer - this probably isnt needed if properly optimized
@@ -355,7 +647,7 @@ void CDynProgramGPU::start_miner(
       uint32_t numComputeUnits,
       uint32_t gpu,
       shares_t& shares,
-      rand_seed_t rand_seed,
+      batch_sizer_t& sizer,
       int localWorkSize
     ) { 
 
@@ -364,73 +656,177 @@ void CDynProgramGPU::start_miner(
     // allocate result hash buffer for each compute unit
     // allocate flag to indicate hash found for each compute unit (this is for later)
     // call kernel code with program, block header, memory buffer, result buffer and flag as params
-    const work_t work = shared_work.clone();
+    const std::shared_ptr<const work_t> snapshot = shared_work.snapshot();
+    const work_t& work = *snapshot;
+    hash_counter_t& hashes = shares.stats.workers[gpu];
+    shares.stats.switch_latency[gpu].record(work.num, work.published);
     cl_int returnVal;
 
-    uint32_t nonce = rand_seed.rand_with_index(gpu);
-
-    memcpy(&kernel.buffHeader[gpu][0], work.native_data, 80);
+    nonce_scheduler_t& nonces = *work.nonces;
+    nonce_batch_t batch{};
+
+    // the program and found buffers are only written while no batch of this device is in flight, and may be
+    // reallocated, so they go before the kernel arguments
+    const std::vector<uint32_t>& byte_code = *work.gpu_byte_code;
+    kernel.loadProgramBuffer(gpu, byte_code.data(), byte_code.size() * sizeof(uint32_t));
+    // room for a few times the hits a run is expected to find at the share target
+    const double expected_found = double(numComputeUnits) * (double(work.share_target) + 1) / 18446744073709551616.0;
+    kernel.sizeFoundBuffers(
+      gpu, uint32_t(std::min<double>(numComputeUnits, expected_found * 4 + CDynGPUKernel::minFound)));
+
+    const uint32_t depth = CDynGPUKernel::pipelineDepth;
+    cl_kernel kernels[CDynGPUKernel::pipelineDepth];
+    auto set_kernel_args = [&](uint32_t slot) {
+        const uint32_t s = gpu * depth + slot;
+        returnVal = clSetKernelArg(kernels[slot], 0, sizeof(cl_mem), (void*)&kernel.clGPUProgramBuffer[gpu]);
+        returnVal = clSetKernelArg(kernels[slot], 1, sizeof(cl_mem), (void*)&kernel.clGPUFoundBuffer[s]);
+        returnVal = clSetKernelArg(kernels[slot], 2, sizeof(cl_mem), (void*)&kernel.clGPUHeaderBuffer[s]);
+        returnVal = clSetKernelArg(kernels[slot], 3, sizeof(work.share_target), (void*)&work.share_target);
+        returnVal = clSetKernelArg(
+          kernels[slot], 4, sizeof(kernel.maxFound[gpu]), (void*)&kernel.maxFound[gpu]);
+    };
+    for (uint32_t slot = 0; slot < depth; slot++) {
+        const uint32_t s = gpu * depth + slot;
+        kernels[slot] = kernel.kernel[s];
+        memcpy(&kernel.buffHeader[s][0], work.native_data, 80);
+        set_kernel_args(slot);
+    }
 
-    returnVal = clEnqueueWriteBuffer(
-      kernel.command_queue[gpu],
-      kernel.clGPUProgramBuffer[gpu],
-      CL_TRUE,
-      0,
-      byte_code.size,
-      byte_code.ptr.get(),
-      0,
-      NULL,
-      NULL);
-
-    while (shared_work == work) {
-        memcpy(&kernel.buffHeader[gpu][76], &nonce, 4);
-
-        returnVal = clEnqueueWriteBuffer(
-          kernel.command_queue[gpu],
-          kernel.clGPUHeaderBuffer[gpu],
-          CL_TRUE,
-          0,
-          kernel.headerBuffSize,
-          kernel.buffHeader[gpu],
-          0,
-          NULL,
-          NULL);
-
-        size_t globalWorkSize = numComputeUnits;
-        size_t iLocalWorkSize = localWorkSize;
-        returnVal = clEnqueueNDRangeKernel(
-          kernel.command_queue[gpu], kernel.kernel[gpu], 1, NULL, &globalWorkSize, &iLocalWorkSize, 0, NULL, NULL);
-
-        returnVal = clFinish(kernel.command_queue[gpu]);
-
-        returnVal = clEnqueueReadBuffer(
-          kernel.command_queue[gpu],
-          kernel.clGPUHashResultBuffer[gpu],
-          CL_TRUE,
-          0,
-          kernel.hashResultSize,
-          kernel.buffHashResult[gpu],
-          0,
-          NULL,
-          NULL);
-
-
-        // find a hash with difficulty higher than share diff
-        for (uint32_t k = 0; k < numComputeUnits; k++) {
-            // read last 8 bytes of hash as [uint64_t] target
-            uint64_t hash_int{};
-            memcpy(&hash_int, &kernel.buffHashResult[gpu][k * 8], 8);
-            hash_int = htobe64(hash_int);
-            // hash target should be lower than share target
-            if (hash_int <= work.share_target) {
-                // append share to queue
-                uint32_t thisNonce = nonce + k;
-                shares.append(work.share(thisNonce));
+    // runs the interpreter kernel until the kernels generated for the program are built, checked between
+    // runs like `cpu_miner` checks for its engine; arguments are taken at enqueue, so runs in flight keep
+    // the kernel they were enqueued with
+    std::shared_ptr<const program_kernels_t> generated{};
+    uint32_t kernels_num = ~program_kernels_num.load(std::memory_order_acquire);
+
+    // batches enqueued on the device, oldest first; the queue is in order, so the header write, counter
+    // reset, kernel and count read of a slot follow each other and only the read needs an event
+    struct in_flight_t {
+        cl_event done = NULL;
+        uint32_t nonce = 0;
+        uint64_t valid = 0;
+    };
+    in_flight_t in_flight[CDynGPUKernel::pipelineDepth];
+    uint32_t oldest = 0;
+    uint32_t pending = 0;
+    bool exhausted = false;
+
+    for (;;) {
+        // keep every slot busy while the job lasts
+        while (pending < depth && !exhausted && shared_work == work) {
+            if (batch.empty()) {
+                sizer.finish();
+                batch = nonces.take(gpu, sizer.size);
+                if (batch.empty()) {
+                    exhausted = true;
+                    break;
+                }
+                sizer.start(batch.size());
+            }
+            if (!generated && program_kernels_num.load(std::memory_order_acquire) != kernels_num) {
+                kernels_num = program_kernels_num.load(std::memory_order_acquire);
+                std::shared_ptr<const program_kernels_t> latest = program_kernels.load();
+                if (latest && latest->str_program == work.str_program) {
+                    generated = std::move(latest);
+                    for (uint32_t slot = 0; slot < depth; slot++) {
+                        kernels[slot] = generated->kernels[gpu * depth + slot];
+                        set_kernel_args(slot);
+                    }
+                }
             }
+            const uint32_t slot = (oldest + pending) % depth;
+            const uint32_t s = gpu * depth + slot;
+            in_flight_t& run = in_flight[slot];
+            run.nonce = nonces.nonce(batch.first);
+            // the last run of a batch goes past its end
+            run.valid = std::min<uint64_t>(numComputeUnits, batch.size());
+            memcpy(&kernel.buffHeader[s][76], &run.nonce, 4);
+
+            returnVal = clEnqueueWriteBuffer(
+              kernel.command_queue[gpu],
+              kernel.clGPUHeaderBuffer[s],
+              CL_FALSE,
+              0,
+              kernel.headerBuffSize,
+              kernel.buffHeader[s],
+              0,
+              NULL,
+              NULL);
+
+            const uint32_t zero = 0;
+            returnVal = clEnqueueFillBuffer(
+              kernel.command_queue[gpu], kernel.clGPUFoundBuffer[s], &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL);
+
+            size_t globalWorkSize = numComputeUnits;
+            size_t iLocalWorkSize = localWorkSize;
+            returnVal = clEnqueueNDRangeKernel(
+              kernel.command_queue[gpu], kernels[slot], 1, NULL, &globalWorkSize, &iLocalWorkSize, 0, NULL, NULL);
+
+            returnVal = clEnqueueReadBuffer(
+              kernel.command_queue[gpu],
+              kernel.clGPUFoundBuffer[s],
+              CL_FALSE,
+              0,
+              sizeof(uint32_t),
+              kernel.buffFound[s],
+              0,
+              NULL,
+              &run.done);
+            returnVal = clFlush(kernel.command_queue[gpu]);
+
+            // increment local nonce
+            batch.first += numComputeUnits;
+            pending++;
         }
-        // increment local nonce
-        nonce += numComputeUnits;
-        // increment global atomic nonce counter
-        shares.stats.nonce_count += numComputeUnits;
+        if (pending == 0) break;
+
+        // scan the oldest batch while the ones behind it run
+        const uint32_t slot = oldest;
+        const uint32_t s = gpu * depth + slot;
+        in_flight_t& run = in_flight[slot];
+        returnVal = clWaitForEvents(1, &run.done);
+        clReleaseEvent(run.done);
+        run.done = NULL;
+        oldest = (oldest + 1) % depth;
+        pending--;
+
+        // the kernel only hands back hashes that meet the share target, the last run of a batch goes
+        // past its end
+        const uint32_t hits = kernel.buffFound[s][0];
+        if (hits > kernel.maxFound[gpu]) {
+            printf("GPU %u: %u hits in one run, the found buffer only holds %u\n", gpu, hits, kernel.maxFound[gpu]);
+        }
+        const uint32_t found = std::min(hits, kernel.maxFound[gpu]);
+        if (found != 0) {
+            // the run is done, its hits are read on the hit queue so the read does not wait for the batch
+            // enqueued behind it
+            returnVal = clEnqueueReadBuffer(
+              kernel.hit_queue[gpu],
+              kernel.clGPUFoundBuffer[s],
+              CL_TRUE,
+              sizeof(uint32_t),
+              found * 3 * sizeof(uint32_t),
+              &kernel.buffFound[s][1],
+              0,
+              NULL,
+              NULL);
+        }
+        for (uint32_t k = 0; k < found; k++) {
+            const uint32_t* hit = &kernel.buffFound[s][1 + k * 3];
+            const uint32_t thisNonce = hit[0];
+            if (thisNonce - run.nonce >= run.valid) continue;
+            const uint64_t hash_int = (uint64_t(hit[1]) << 32) | hit[2];
+            // append share to queue
+            shares.append(work.share(thisNonce, hash_int));
+        }
+        // increment the device's nonce counter, without the overshoot of a batch's last run
+        hashes.add(run.valid);
+    }
+
+    // a difficulty change keeps the scheduler, the next snapshot runs what is left of the batch
+    nonces.give_back(gpu, batch);
+
+    if (exhausted) {
+        if (!nonces.exhausted.test_and_set()) shared_work.exhausted(work);
+        shared_work.wait_for_next(work);
     }
 }
@@ -1,36 +1,82 @@
 #pragma once
 #include "dyn_stratum.h"
-#include "util/rand.h"
+#include "util/nonce.h"
+#include "util/shared.h"
 
 #include <CL/cl.h>
 #include <CL/cl_platform.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 struct CDynGPUKernel {
+    // batches each device keeps in flight, every slot has its own kernel, header and result buffers
+    // so the host can scan one batch while the next runs; slot arrays are indexed [device * pipelineDepth + slot]
+    static constexpr uint32_t pipelineDepth = 2;
+
     uint32_t numOpenCLDevices;
     cl_device_id* openCLDevices;
+    // devices of the platform mined on, see `--opencl-devices`; CPU devices (e.g. POCL) run the same pipeline
+    cl_device_type deviceType = CL_DEVICE_TYPE_GPU;
 
+    // grown by `loadProgramBuffer` when a program needs more room than the ones before it
     cl_mem* clGPUProgramBuffer;
+    size_t* programBuffSize;
 
-    uint32_t hashResultSize;
-    cl_mem* clGPUHashResultBuffer;
-    uint32_t** buffHashResult;
+    // hits a run of a device can hand back, the count in the first word of the found buffer may exceed it;
+    // grown by `sizeFoundBuffers` when the share target lets a run find more
+    static constexpr uint32_t minFound = 64;
+    uint32_t* maxFound;
+    uint32_t* foundBuffSize;
+    cl_mem* clGPUFoundBuffer;
+    uint32_t** buffFound;
 
     uint32_t headerBuffSize;
     cl_mem* clGPUHeaderBuffer;
     unsigned char** buffHeader;
 
     cl_kernel* kernel;
+    cl_context* context;
     cl_command_queue* command_queue;
+    // reads the hits of a finished run, the found count comes back on `command_queue` first
+    cl_command_queue* hit_queue;
 
     cl_platform_id* platform_id;
 
+    // dyn_miner.cl, built in (see dyn_miner_cl.h) unless `--kernel-source` names a file; the generated kernels
+    // are built along with it for its helpers
+    std::string kernelSource;
+
+    static constexpr const char* buildOptions = "";
+    // built programs are kept here and loaded on the next start instead of building them again, see
+    // `--kernel-cache`; empty to always build from source
+    std::string kernelCacheDir = "kernel-cache";
+
     CDynGPUKernel();
 
-    void initOpenCL(int platformID, int computeUnits, const std::vector<std::string>& program);
+    void initOpenCL(int platformID);
+
+    // makes room for `found` hits in the found buffers of a device's slots, must not be called while a batch of
+    // the device is in flight
+    void sizeFoundBuffers(uint32_t device, uint32_t found);
+
+    // writes a program's byte code to a device, must not be called while a batch of the device is in flight
+    void loadProgramBuffer(uint32_t device, const void* code, size_t size);
+
+    // reads `kernelSource` from a file, false if it cannot be read
+    bool readKernelSource(const std::string& path);
+
+    // builds `source` for a device or loads it from the cache, prints the build log and returns NULL if it fails;
+    // without `cache` it is always built from source and not kept
+    cl_program buildProgram(uint32_t device, const std::string& source, bool cache = true);
+
+    // cache file of `source` built for a device, named by a hash of the device, driver, build options and source
+    std::string binaryPath(uint32_t device, const std::string& source) const;
+    cl_program loadBinary(uint32_t device, const std::string& path);
+    void saveBinary(cl_program program, const std::string& path);
 
     // prints GPU info
     void print();
@@ -40,22 +86,34 @@ struct CDynProgramGPU {
     CDynGPUKernel kernel;
 
     void start_miner(
-      shared_work_t& shared_work, uint32_t numComputeUnits, uint32_t gpuIndex, shares_t& shares, rand_seed_t rand_seed, int localWorkSize);
-    struct free_delete {
-        void operator()(uint32_t* bc) { free(bc); }
+      shared_work_t& shared_work, uint32_t numComputeUnits, uint32_t gpuIndex, shares_t& shares, batch_sizer_t& sizer, int localWorkSize);
+    // of the latest `load_byte_code`, only used by the threads that publish jobs
+    char prev_block_hash[32] = {0};
+    char merkle_root[32] = {0};
+    std::string str_program{};
+    program_ir_t program_ir{}; // optimized, assembled for every job since READMEM slots depend on it
+    std::shared_ptr<const std::vector<uint32_t>> byte_code{};
+
+    // kernels generated for one program, indexed like the slot arrays of `CDynGPUKernel`
+    struct program_kernels_t {
+        std::string str_program{};
+        std::vector<cl_kernel> kernels{};
+
+        ~program_kernels_t() {
+            for (cl_kernel k : kernels)
+                clReleaseKernel(k);
+        }
     };
 
-    using byte_code_ptr = std::unique_ptr<uint32_t, free_delete>;
+    locked_shared_ptr_t<const program_kernels_t> program_kernels{};
+    uint32_t program_kernels_request = 0; // latest `build_program_kernels` call, older builds are dropped
+    std::atomic<uint32_t> program_kernels_num{}; // changes after every built `program_kernels`, cheap to poll
+    std::mutex program_kernels_mutex{};
 
-    struct byte_code_t {
-        byte_code_ptr ptr;
-        std::size_t size;
-    };
-
-    char prev_block_hash[32] = {0};
-    char merkle_root[32] = {0};
-    byte_code_t byte_code;
+    // assembles the byte code of `work` into `work.gpu_byte_code`, with `publish_mutex` held
+    void load_byte_code(work_t&);
 
-    // loads byte code to cache
-    void load_byte_code(const work_t&);
+    // generates straight-line kernels for the program of `work` and builds them in the background,
+    // the devices run the interpreter kernel `dyn_hash` until then; expects `kernel` set up by `initOpenCL`
+    void build_program_kernels(const work_t&);
 };
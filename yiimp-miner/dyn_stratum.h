@@ -1,17 +1,24 @@
 #pragma once
 
+#include "core/sha256.h"
+#include "dyn_jit.h"
+#include "dyn_threaded.h"
 #include "dynprogram.h"
 #include "util/difficulty.h"
 #include "util/hex.h" // TODO: remove, only for debug
+#include "util/nonce.h"
+#include "util/shared.h"
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <optional>
-#include <queue>
-#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 struct rpc_config_t {
     char* host;
@@ -21,48 +28,172 @@ struct rpc_config_t {
     std::string miner_pay_to_addr;
 };
 
+// hashes of one CPU thread or GPU, alone on its cache line; only its worker writes it
+struct alignas(64) hash_counter_t {
+    std::atomic<uint64_t> count{};
+
+    inline void add(uint64_t n) { count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    inline uint64_t load() const { return count.load(std::memory_order_relaxed); }
+};
+
+// how long a CPU thread or GPU took from the publication of a job to hashing it, in log2 buckets of
+// microseconds; only its worker writes it
+struct alignas(64) switch_latency_t {
+    static constexpr std::size_t buckets = 20; // bucket b counts [2^b, 2^(b+1)) us, the last one everything above
+
+    std::atomic<uint32_t> counts[buckets]{};
+    std::atomic<uint64_t> max_us{};
+    uint32_t last_job = 0;
+
+    // when the worker starts hashing job `num`; the first job is not a switch
+    void record(uint32_t num, std::chrono::steady_clock::time_point published) {
+        if (num == last_job) return;
+        const bool first = last_job == 0;
+        last_job = num;
+        if (first) return;
+
+        const uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - published)
+                              .count();
+        std::size_t bucket = 0;
+        while (bucket + 1 < buckets && (uint64_t(2) << bucket) <= us)
+            bucket++;
+        counts[bucket].store(counts[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (us > max_us.load(std::memory_order_relaxed)) max_us.store(us, std::memory_order_relaxed);
+    }
+
+    uint64_t total() const {
+        uint64_t total = 0;
+        for (std::size_t i = 0; i < buckets; i++)
+            total += counts[i].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // upper bound in microseconds of the latency `fraction` of the switches stay within
+    uint64_t quantile(double fraction) const {
+        const uint64_t wanted = std::max<uint64_t>(1, uint64_t(fraction * total() + 0.5));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= wanted) return std::min(uint64_t(2) << i, max_us.load(std::memory_order_relaxed));
+        }
+        return max_us.load(std::memory_order_relaxed);
+    }
+};
+
 struct stats_t {
-    std::atomic<uint64_t> nonce_count{};
+    std::unique_ptr<hash_counter_t[]> workers{}; // one per GPU and CPU thread, see `set_workers`
+    std::unique_ptr<switch_latency_t[]> switch_latency{}; // same slots as `workers`
+    std::size_t worker_count = 0;
+    std::size_t gpu_count = 0; // GPUs have the first slots, CPU threads the rest
     std::atomic<uint64_t> share_count{};
     std::atomic<uint32_t> accepted_share_count{};
     std::atomic<uint32_t> rejected_share_count{};
+    std::atomic<uint32_t> dropped_share_count{}; // found while the share ring was full
+    std::atomic<uint32_t> exhausted_count{};     // jobs or rolls of them whose nonces were all hashed
     std::atomic<uint32_t> latest_diff{};
+
+    // before any worker starts
+    void set_workers(std::size_t gpus, std::size_t cpus) {
+        workers.reset(new hash_counter_t[gpus + cpus]);
+        switch_latency.reset(new switch_latency_t[gpus + cpus]);
+        worker_count = gpus + cpus;
+        gpu_count = gpus;
+    }
+
+    uint64_t nonce_count() const {
+        uint64_t total = 0;
+        for (std::size_t i = 0; i < worker_count; i++)
+            total += workers[i].load();
+        return total;
+    }
 };
 
 // mining.submit:
 // [0]: username
 // [1]: job_id
-// [2]: extranonce2 0000000000000000
+// [2]: extranonce2
 // [3]: ntime
 // [4]: nonce
+// [5]: version bits, only with version rolling
+// the submit thread takes job_id, extranonce2, ntime and version bits from the job snapshot matching `job_num`,
+// see `shared_work_t::find`
 struct share_t {
-    uint32_t job_num;
-    std::string job_id;
-    std::string hex_ntime;
-    char nonce[4] = {0};
+    uint32_t job_num = 0;
+    uint32_t nonce = 0; // as written into the header
+    uint64_t hash = 0;  // first 8 bytes of the hash read big-endian, see `work_t::share_target`
 };
 
-struct shares_t {
-    std::queue<share_t> queue;
-    std::mutex mutex;
-    stats_t stats{};
-    std::atomic_flag notify = ATOMIC_FLAG_INIT;
+// bounded lock-free ring, any thread pushes and one thread at a time pops
+template <std::size_t N>
+struct share_ring_t {
+    static_assert((N & (N - 1)) == 0, "ring size has to be a power of two");
+
+    // `sequence` tells whose turn a cell is: pos for the producer of pos, pos + 1 for the consumer
+    struct cell_t {
+        std::atomic<std::size_t> sequence;
+        share_t share;
+    };
+
+    cell_t cells[N];
+    alignas(64) std::atomic<std::size_t> head{};
+    alignas(64) std::size_t tail = 0;
+
+    share_ring_t() {
+        for (std::size_t i = 0; i < N; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // false when the ring is full
+    bool push(const share_t& share) {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            cell_t& cell = cells[pos & (N - 1)];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == pos) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.share = share;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < pos) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
 
     std::optional<share_t> pop() {
-        std::unique_lock<std::mutex> _lock(mutex);
-        if (queue.empty()) {
+        cell_t& cell = cells[tail & (N - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != tail + 1) {
             return std::nullopt;
         }
-        share_t share = queue.front();
-        queue.pop();
+        const share_t share = cell.share;
+        cell.sequence.store(tail + N, std::memory_order_release);
+        tail++;
         return share;
     }
+};
 
-    void append(share_t share) {
-        std::unique_lock<std::mutex> _lock(mutex);
-        queue.push(share);
+struct shares_t {
+    share_ring_t<2048> ring{};
+    std::mutex pop_mutex{}; // the submit thread of a closed connection may still be popping
+    stats_t stats{};
+    std::atomic_flag notify = ATOMIC_FLAG_INIT;
+
+    std::optional<share_t> pop() {
+        std::unique_lock<std::mutex> _lock(pop_mutex);
+        return ring.pop();
+    }
+
+    void append(const share_t& share) {
+        if (!ring.push(share)) {
+            stats.dropped_share_count++;
+            return;
+        }
         stats.share_count++;
-        [[maybe_unused]] bool value = notify.test_and_set(std::memory_order_acquire);
+        [[maybe_unused]] bool value = notify.test_and_set(std::memory_order_release);
         notify.notify_one();
     }
 };
@@ -79,6 +210,82 @@ inline std::vector<std::string> load_program(std::string strProgram, char delim)
 
 constexpr double diff_multiplier = 65536;
 
+// what the coinbase and the merkle root of a job are made of, shared by all extranonce2 rolls of the job;
+// the coinbase is coinb1 + extranonce1 + extranonce2 + coinb2
+struct coinbase_t {
+    std::vector<unsigned char> coinb1{};
+    std::vector<unsigned char> coinb2{};
+    std::vector<unsigned char> extranonce1{}; // from mining.subscribe, empty with pools that do not send one
+    uint32_t extranonce2_size = 0;
+    std::vector<std::array<unsigned char, 32>> merkle_branch{};
+
+    // the largest extranonce2 that fits `extranonce2_size`
+    uint64_t last_extranonce2() const {
+        return extranonce2_size >= 8 ? UINT64_MAX : (uint64_t(1) << (8 * extranonce2_size)) - 1;
+    }
+
+    // `extranonce2_size` bytes, big-endian with the value in the last 8 of them
+    void extranonce2_bytes(uint64_t extranonce2, unsigned char* out) const {
+        for (uint32_t i = 0; i < extranonce2_size; i++) {
+            const uint32_t shift = 8 * (extranonce2_size - 1 - i);
+            out[i] = shift < 64 ? uint8_t(extranonce2 >> shift) : 0;
+        }
+    }
+
+    // 32-byte merkle roots, in header byte order, of extranonce2 `first` to `first + count - 1`; the part of the
+    // coinbase before extranonce2 is hashed once and every branch level is hashed for all of them with SHA256D64
+    void merkle_roots(unsigned char* roots, uint64_t first, std::size_t count) const {
+        CSHA256 prefix;
+        prefix.Write(coinb1.data(), coinb1.size());
+        prefix.Write(extranonce1.data(), extranonce1.size());
+
+        std::vector<unsigned char> tail(extranonce2_size + coinb2.size());
+        std::copy(coinb2.begin(), coinb2.end(), tail.begin() + extranonce2_size);
+
+        // node i is the root so far in its first half and the branch hash next to it
+        std::vector<unsigned char> nodes(count * 64);
+        unsigned char hash[32];
+        for (std::size_t i = 0; i < count; i++) {
+            extranonce2_bytes(first + i, tail.data());
+            CSHA256(prefix).Write(tail.data(), tail.size()).Finalize(hash);
+            CSHA256().Write(hash, 32).Finalize(nodes.data() + i * 64);
+        }
+
+        std::vector<unsigned char> level(count * 32);
+        for (const std::array<unsigned char, 32>& branch : merkle_branch) {
+            for (std::size_t i = 0; i < count; i++)
+                memcpy(nodes.data() + i * 64 + 32, branch.data(), 32);
+            SHA256D64(level.data(), nodes.data(), count);
+            for (std::size_t i = 0; i < count; i++)
+                memcpy(nodes.data() + i * 64, level.data() + i * 32, 32);
+        }
+        for (std::size_t i = 0; i < count; i++)
+            memcpy(roots + i * 32, nodes.data() + i * 64, 32);
+    }
+};
+
+// merkle roots of consecutive extranonce2 values of one job, built `batch` at a time so most rolls only copy one
+struct merkle_roots_t {
+    static constexpr uint64_t batch = 64;
+
+    std::shared_ptr<const coinbase_t> coinbase{};
+    uint64_t first = 0;
+    uint64_t count = 0;
+    std::vector<unsigned char> roots{};
+
+    // root of `extranonce2` of `of` in header byte order, builds the batch starting at it when it is not cached
+    const unsigned char* root(const std::shared_ptr<const coinbase_t>& of, uint64_t extranonce2) {
+        if (of != coinbase || extranonce2 < first || extranonce2 - first >= count) {
+            coinbase = of;
+            first = extranonce2;
+            count = std::min(batch - 1, of->last_extranonce2() - extranonce2) + 1;
+            roots.resize(count * 32);
+            of->merkle_roots(roots.data(), first, count);
+        }
+        return roots.data() + (extranonce2 - first) * 32;
+    }
+};
+
 struct work_t {
     uint32_t num = 0;
     std::string job_id{};
@@ -87,35 +294,122 @@ struct work_t {
     char merkle_root[32] = {0};
     uint64_t share_target{};
     unsigned char native_data[80] = {0};
+    SHA256HeaderMidstate midstate{};
     std::vector<std::string> program{};
     std::string str_program{};
-    program_t cpu_program{};
+    program_t cpu_program{}; // interpreter form until the threads pick up the `cpu_engine_t` of the program
+    std::shared_ptr<const std::vector<uint32_t>> gpu_byte_code{}; // see `CDynProgramGPU::load_byte_code`
+    std::shared_ptr<nonce_scheduler_t> nonces{}; // one per job, kept when only the difficulty changes
+    std::shared_ptr<const coinbase_t> coinbase{std::make_shared<const coinbase_t>()};
+    uint64_t extranonce2 = 0;
+    uint32_t version = 0x40;
+    uint32_t version_mask = 0; // bits the pool lets the miner roll (BIP310), see `roll_version`
+    uint32_t version_bits = 0; // rolled bits, within `version_mask`
+    uint32_t ntime = 0;        // from the job
+    uint32_t ntime_roll = 0;   // seconds added to `ntime`, see `roll_ntime`
+    uint32_t ntime_window = 0; // largest `ntime_roll` the pool accepts, 0 without ntime rolling
+    std::chrono::steady_clock::time_point published{}; // set by `shared_work_t::publish`
 
+    // expects `prev_block_hash` and `merkle_root` of the job, they select the memory slots READMEM reads
     bool set_program(const std::string& new_program_str) {
-        if (new_program_str == str_program) {
-            return false;
+        const bool changed = new_program_str != str_program;
+        if (changed) {
+            program = load_program(new_program_str, '$');
+            str_program = new_program_str;
+            cpu_program = program_to_bytecode(program);
+            cpu_program.plan_memgen();
         }
-        program = load_program(new_program_str, '$');
-        str_program = new_program_str;
-        cpu_program = program_to_bytecode(program);
-        return true;
+        cpu_program.resolve_memgen(prev_block_hash, merkle_root);
+        return changed;
     }
 
-    share_t share(char* nonce) const {
-        share_t share;
-        share.job_num = num;
-        share.job_id = job_id;
-        share.hex_ntime = hex_ntime;
-        memcpy(share.nonce, nonce, 4);
-        return share;
+    std::string hex_extranonce2() const {
+        std::vector<unsigned char> bytes(coinbase->extranonce2_size);
+        coinbase->extranonce2_bytes(extranonce2, bytes.data());
+        return makeHex(bytes.data(), bytes.size());
+    }
+
+    // puts `root` (header byte order) into the header; expects the rest of `native_data` set, the midstate
+    // is updated
+    void set_merkle_root(const unsigned char* root) {
+        memcpy(native_data + 36, root, 32);
+
+        // reverse merkle root...why?  because bitcoin
+        for (int i = 0; i < 32; i++)
+            merkle_root[i] = root[31 - i];
+
+        // bytes 0..75 are fixed for the job, cache the SHA256 midstate of the header
+        SHA256PrepareHeader(midstate, native_data);
+    }
+
+    void set_merkle_root() {
+        unsigned char root[32];
+        coinbase->merkle_roots(root, extranonce2, 1);
+        set_merkle_root(root);
+    }
+
+    // puts the version with the rolled bits into the header, the midstate is left to the caller
+    void set_version() {
+        const uint32_t header_version = (version & ~version_mask) | version_bits;
+        memcpy(native_data, &header_version, 4);
+    }
+
+    // the rolled bits count up in the places of `version_mask`, 0 after the last value
+    uint32_t next_version_bits() const { return ((version_bits | ~version_mask) + 1) & version_mask; }
+
+    bool has_next_version() const { return next_version_bits() != 0; }
+
+    // only the first block of the header changes, the merkle root and the READMEM slots stay
+    void roll_version() {
+        version_bits = next_version_bits();
+        set_version();
+        SHA256PrepareHeader(midstate, native_data);
+    }
+
+    // puts the rolled ntime into the header and `hex_ntime`, the midstate is left to the caller
+    void set_ntime() {
+        const uint32_t header_ntime = ntime + ntime_roll;
+        memcpy(native_data + 68, &header_ntime, 4);
+        char hex[9];
+        sprintf(hex, "%08x", header_ntime);
+        hex_ntime = hex;
     }
 
-    share_t share(uint32_t nonce) const {
+    bool has_next_ntime() const { return ntime_roll < ntime_window; }
+
+    // only the second block of the header changes, the merkle root and the READMEM slots stay; the version
+    // bits start over
+    void roll_ntime() {
+        ntime_roll++;
+        version_bits = 0;
+        set_version();
+        set_ntime();
+        SHA256PrepareHeader(midstate, native_data);
+    }
+
+    bool has_next_extranonce2() const {
+        return coinbase->extranonce2_size != 0 && extranonce2 < coinbase->last_extranonce2();
+    }
+
+    // moves to the next extranonce2 with the version bits and ntime back at the job's, `roots` has its
+    // merkle root; the READMEM slots follow the new root
+    void roll_extranonce2(merkle_roots_t& roots) {
+        extranonce2++;
+        version_bits = 0;
+        set_version();
+        if (ntime_roll != 0) {
+            ntime_roll = 0;
+            set_ntime();
+        }
+        set_merkle_root(roots.root(coinbase, extranonce2));
+        cpu_program.resolve_memgen(prev_block_hash, merkle_root);
+    }
+
+    share_t share(uint32_t nonce, uint64_t hash) const {
         share_t share;
         share.job_num = num;
-        share.job_id = job_id;
-        share.hex_ntime = hex_ntime;
-        memcpy(share.nonce, &nonce, 4);
+        share.nonce = nonce;
+        share.hash = hash;
         return share;
     }
 
@@ -125,21 +419,89 @@ struct work_t {
     }
 };
 
+// how the CPU threads run programs once the optimized engine is built, see `--engine`
+enum class cpu_engine_kind {
+    interpreter, // `execute_program_lanes`
+    threaded,    // direct-threaded interpreter, see dyn_threaded.h
+    jit,         // native code, see dyn_jit.h
+};
+
+// optimized form of a program for the CPU threads, built in the background when the program changes
+struct cpu_engine_t {
+    std::string str_program{};
+    program_t program{}; // optimized and planned, the threads resolve the memory slots for their job
+    std::shared_ptr<const threaded_program_t> threaded{};
+    std::shared_ptr<const jit_program_t> jit{};
+};
+
+// jobs are published as immutable snapshots, threads pick one up with a single load and keep it
+// alive while they hash; the stratum thread (see `dyn_miner::set_job`) and the roller of exhausted jobs
+// (see `dyn_miner::roll_exhausted_jobs`) publish under `publish_mutex`
 struct shared_work_t {
-    work_t work{};
-    std::shared_mutex mutex{};
-    std::atomic<std::uint32_t> num{};
+    locked_shared_ptr_t<const work_t> work{std::make_shared<const work_t>()};
+    std::atomic<std::uint32_t> num{}; // `num` of the latest job, cheap to poll
+    locked_shared_ptr_t<const cpu_engine_t> engine{};
+    std::atomic<std::uint32_t> engine_num{}; // changes after every `engine` store, cheap to poll
+    std::atomic<std::uint32_t> exhausted_num{}; // latest job whose nonces were all handed out
+    std::mutex publish_mutex{};
 
-    work_t clone() {
-        std::shared_lock<std::shared_mutex> _lock(mutex);
-        return work;
+    // the latest published snapshots by `num`, a share found on a rolled job or before a difficulty change
+    // is still submitted with the extranonce2, ntime and version bits it was hashed with
+    static constexpr uint32_t recent_size = 64;
+    std::array<std::shared_ptr<const work_t>, recent_size> recent{};
+    mutable std::mutex recent_mutex{};
+
+    void set_engine(std::shared_ptr<const cpu_engine_t> new_engine) {
+        engine.store(std::move(new_engine));
+        engine_num++;
+    }
+
+    std::shared_ptr<const work_t> snapshot() const { return work.load(); }
+
+    // the snapshot published as `job_num`, or null once it fell out of `recent`
+    std::shared_ptr<const work_t> find(uint32_t job_num) const {
+        std::unique_lock<std::mutex> _lock(recent_mutex);
+        const std::shared_ptr<const work_t>& found = recent[job_num % recent_size];
+        if (found && found->num == job_num) return found;
+        return nullptr;
+    }
+
+    // makes `new_work` the current job, with `publish_mutex` held
+    void publish(work_t&& new_work) {
+        const uint32_t new_num = num.load(std::memory_order_relaxed) + 1;
+        new_work.num = new_num;
+        new_work.published = std::chrono::steady_clock::now();
+        std::shared_ptr<const work_t> published = std::make_shared<const work_t>(std::move(new_work));
+        {
+            std::unique_lock<std::mutex> _lock(recent_mutex);
+            recent[new_num % recent_size] = published;
+        }
+        work.store(std::move(published));
+        num.store(new_num);
+        num.notify_all();
     }
 
     void set_difficulty(double diff) {
-        std::unique_lock<std::shared_mutex> _lock(mutex);
-        work.set_difficulty(diff);
-        if (work.num != 0) {
-            work.num = ++num;
+        std::unique_lock<std::mutex> _lock(publish_mutex);
+        work_t new_work = *snapshot();
+        new_work.set_difficulty(diff);
+        if (new_work.num != 0) {
+            publish(std::move(new_work));
+        } else {
+            work.store(std::make_shared<const work_t>(std::move(new_work)));
+        }
+    }
+
+    // by the first worker that finds no nonces of `work` left
+    void exhausted(const work_t& work) {
+        exhausted_num.store(work.num);
+        exhausted_num.notify_all();
+    }
+
+    // for a worker that ran out of nonces, returns once `work` is replaced
+    void wait_for_next(const work_t& work) const {
+        while (*this == work) {
+            num.wait(work.num);
         }
     }
 
@@ -0,0 +1,202 @@
+#include "dyn_threaded.h"
+
+#if defined(__GNUC__)
+#define THREADED_GOTO 1
+#endif
+
+namespace {
+
+// `N` lanes, 0 when only known at run time
+template <std::size_t N>
+const void* const* run_ops(lanes_state_t* state, const threaded_op_t* ip) {
+#ifdef THREADED_GOTO
+    // indexed by `hashop`, the last entry ends the program
+    static const void* const labels[] = {
+      &&op_add,
+      &&op_xor,
+      &&op_sha,
+      &&op_sha,
+      &&op_memgen,
+      &&op_memadd,
+      &&op_memxor,
+      &&op_mem_select,
+      &&op_mem_fused,
+      &&op_end,
+    };
+    if (!ip) return labels;
+#define CASE(label, op) label
+#define NEXT(n)                                                                                                        \
+    ip += n;                                                                                                           \
+    goto* ip->handler
+#else
+    if (!ip) return nullptr;
+#define CASE(label, op) case op
+#define NEXT(n)                                                                                                        \
+    ip += n;                                                                                                           \
+    continue
+#endif
+
+    const std::size_t lanes = N ? N : state->lanes;
+    uint32_t* hash = state->hash;
+
+#ifdef THREADED_GOTO
+    goto* ip->handler;
+#else
+    for (;;) {
+        switch (ip->op) {
+#endif
+
+    CASE(op_add, hashop::ADD) : {
+        for (uint32_t i = 0; i < 8; i++)
+            for (std::size_t lane = 0; lane < lanes; lane++)
+                hash[i * lanes + lane] += ip->operand[i];
+        NEXT(1);
+    }
+    CASE(op_xor, hashop::XOR) : {
+        for (uint32_t i = 0; i < 8; i++)
+            for (std::size_t lane = 0; lane < lanes; lane++)
+                hash[i * lanes + lane] ^= ip->operand[i];
+        NEXT(1);
+    }
+#ifndef THREADED_GOTO
+    case hashop::SHA_SINGLE:
+#endif
+    CASE(op_sha, hashop::SHA_LOOP) : {
+        state->sha(ip->count);
+        NEXT(1);
+    }
+    CASE(op_memgen, hashop::MEMGEN) : {
+        const uint32_t args[2] = {static_cast<uint32_t>(ip->memgen_op), ip->count};
+        state->memgen(args);
+        NEXT(1);
+    }
+    CASE(op_memadd, hashop::MEMADD) : {
+        for (uint32_t e = state->mem_first; e < state->mem_last; e++) {
+            uint32_t* entry = state->mempool->get() + e * 8 * lanes;
+            for (uint32_t i = 0; i < 8; i++)
+                for (std::size_t lane = 0; lane < lanes; lane++)
+                    entry[i * lanes + lane] += ip->operand[i];
+        }
+        NEXT(1);
+    }
+    CASE(op_memxor, hashop::MEMXOR) : {
+        for (uint32_t e = state->mem_first; e < state->mem_last; e++) {
+            uint32_t* entry = state->mempool->get() + e * 8 * lanes;
+            for (uint32_t i = 0; i < 8; i++)
+                for (std::size_t lane = 0; lane < lanes; lane++)
+                    entry[i * lanes + lane] ^= ip->operand[i];
+        }
+        NEXT(1);
+    }
+    CASE(op_mem_select, hashop::MEM_SELECT) : {
+        const uint32_t args[1] = {static_cast<uint32_t>(ip->region)};
+        state->mem_select(args);
+        NEXT(1);
+    }
+    CASE(op_mem_fused, hashop::MEM_FUSED) : {
+        // the parts follow as MEMADD/MEMXOR records
+        const threaded_op_t* parts = ip + 1;
+        for (uint32_t e = state->mem_first; e < state->mem_last; e++) {
+            uint32_t* entry = state->mempool->get() + e * 8 * lanes;
+            for (uint32_t k = 0; k < ip->count; k++) {
+                const threaded_op_t& part = parts[k];
+                if (part.op == hashop::MEMADD) {
+                    for (uint32_t i = 0; i < 8; i++)
+                        for (std::size_t lane = 0; lane < lanes; lane++)
+                            entry[i * lanes + lane] += part.operand[i];
+                } else {
+                    for (uint32_t i = 0; i < 8; i++)
+                        for (std::size_t lane = 0; lane < lanes; lane++)
+                            entry[i * lanes + lane] ^= part.operand[i];
+                }
+            }
+        }
+        NEXT(1 + ip->count);
+    }
+    CASE(op_end, hashop::UNKNOWN) : return nullptr;
+
+#ifndef THREADED_GOTO
+        }
+    }
+#endif
+#undef CASE
+#undef NEXT
+}
+
+} // namespace
+
+std::shared_ptr<const threaded_program_t> threaded_compile(const program_t& program, std::size_t lanes) {
+    auto threaded = std::make_shared<threaded_program_t>();
+    threaded->lanes = lanes;
+    switch (lanes) {
+    case 1:
+        threaded->entry = run_ops<1>;
+        break;
+    case 2:
+        threaded->entry = run_ops<2>;
+        break;
+    case 4:
+        threaded->entry = run_ops<4>;
+        break;
+    case 8:
+        threaded->entry = run_ops<8>;
+        break;
+    default:
+        threaded->entry = run_ops<0>;
+        break;
+    }
+
+    std::vector<threaded_op_t>& ops = threaded->ops;
+    auto reader = program.reader();
+    while (!reader.empty()) {
+        threaded_op_t op{};
+        op.op = reader.read_op();
+        switch (op.op) {
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::MEMADD:
+        case hashop::MEMXOR:
+            for (uint32_t i = 0; i < 8; i++)
+                op.operand[i] = reader.pop();
+            break;
+        case hashop::SHA_SINGLE:
+            op.op = hashop::SHA_LOOP;
+            op.count = 1;
+            break;
+        case hashop::SHA_LOOP:
+            op.count = reader.pop();
+            break;
+        case hashop::MEMGEN:
+            op.memgen_op = reader.read_op();
+            op.count = reader.pop();
+            break;
+        case hashop::MEM_SELECT:
+            op.region = reader.read_memregion();
+            break;
+        case hashop::MEM_FUSED:
+            op.count = reader.pop();
+            ops.push_back(op);
+            for (uint32_t k = 0; k < op.count; k++) {
+                threaded_op_t part{};
+                part.op = reader.read_op();
+                for (uint32_t i = 0; i < 8; i++)
+                    part.operand[i] = reader.pop();
+                ops.push_back(part);
+            }
+            continue;
+        case hashop::UNKNOWN:
+            continue;
+        }
+        ops.push_back(op);
+    }
+    ops.push_back(threaded_op_t{});
+
+    // parts of MEM_FUSED are never dispatched to, their handler stays unused
+    if (const void* const* labels = threaded->entry(nullptr, nullptr)) {
+        for (threaded_op_t& op : ops) {
+            const uint32_t index = op.op == hashop::UNKNOWN ? uint32_t(hashop::MEM_FUSED) + 1 : uint32_t(op.op);
+            op.handler = labels[index];
+        }
+    }
+    return threaded;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "dynprogram.h"
+
+#include <memory>
+#include <vector>
+
+// one pre-decoded op, the operand comes first so ADD/XOR/MEMADD/MEMXOR read it with aligned vector loads
+struct alignas(32) threaded_op_t {
+    uint32_t operand[8] = {0};             // ADD, XOR, MEMADD, MEMXOR
+    const void* handler = nullptr;         // label the interpreter jumps to for this op
+    hashop op = hashop::UNKNOWN;           // UNKNOWN ends the program
+    uint32_t count = 0;                    // SHA_LOOP iterations, MEMGEN entries, MEM_FUSED parts after this op
+    hashop memgen_op = hashop::UNKNOWN;    // MEMGEN
+    memregion region = memregion::unknown; // MEM_SELECT
+};
+
+// program decoded for the direct-threaded interpreter, immutable once built and shared by all CPU threads
+struct threaded_program_t {
+    // with null arguments it returns its label table instead of running
+    using entry_t = const void* const* (*)(lanes_state_t*, const threaded_op_t*);
+
+    std::size_t lanes = 1;
+    std::vector<threaded_op_t> ops{};
+    entry_t entry = nullptr;
+
+    // runs the program on `lanes` consecutive header hashes, the result is left in `state`
+    inline void run(lanes_state_t& state, const uint32_t* header_hashes) const {
+        state.load(header_hashes);
+        entry(&state, ops.data());
+    }
+};
+
+// decodes `program` for `lanes` nonces at once, dispatches with computed goto where the compiler has it
+std::shared_ptr<const threaded_program_t> threaded_compile(const program_t& program, std::size_t lanes);
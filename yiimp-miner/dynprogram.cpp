@@ -1,9 +1,12 @@
 #include "dynprogram.h"
 
 #include "core/sha256.h"
+#include "util/common.h"
 #include "util/hex.h"
 
+#include <algorithm>
 #include <array>
+#include <cstdio>
 #include <cstring>
 #include <iterator>
 #include <sstream>
@@ -90,6 +93,7 @@ program_t program_to_bytecode(const std::vector<std::string>& program) {
             break;
         case hashop::MEM_SELECT:
             builder.bytecode.push_back(static_cast<uint32_t>(parse_memregion(tokens[1])));
+        case hashop::MEM_FUSED:
         case hashop::UNKNOWN:
             break;
         }
@@ -97,6 +101,402 @@ program_t program_to_bytecode(const std::vector<std::string>& program) {
     return builder;
 }
 
+program_ir_t bytecode_to_ir(const program_t& program) {
+    program_ir_t ir{};
+    auto reader = program.reader();
+    while (!reader.empty()) {
+        ir_op_t op{};
+        op.op = reader.read_op();
+        switch (op.op) {
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::MEMADD:
+        case hashop::MEMXOR:
+            for (uint32_t i = 0; i < 8; i++)
+                op.operand[i] = reader.pop();
+            break;
+        case hashop::SHA_SINGLE:
+            op.count = 1;
+            break;
+        case hashop::SHA_LOOP:
+            op.count = reader.pop();
+            break;
+        case hashop::MEMGEN:
+            op.memgen_op = reader.read_op();
+            op.count = reader.pop();
+            break;
+        case hashop::MEM_SELECT:
+            op.region = reader.read_memregion();
+            break;
+        case hashop::MEM_FUSED: {
+            const uint32_t count = reader.pop();
+            for (uint32_t k = 0; k < count; k++) {
+                ir_op_t part{};
+                part.op = reader.read_op();
+                for (uint32_t i = 0; i < 8; i++)
+                    part.operand[i] = reader.pop();
+                ir.push_back(part);
+            }
+            continue;
+        }
+        case hashop::UNKNOWN:
+            break;
+        }
+        ir.push_back(op);
+    }
+    return ir;
+}
+
+static inline bool is_mem_op(const ir_op_t& op) { return op.op == hashop::MEMADD || op.op == hashop::MEMXOR; }
+
+program_t ir_to_bytecode(const program_ir_t& ir) {
+    program_t builder{};
+    for (size_t i = 0; i < ir.size(); i++) {
+        const ir_op_t& op = ir[i];
+
+        // runs of pool ops are applied in a single pass over the pool
+        size_t run = 0;
+        while (i + run < ir.size() && is_mem_op(ir[i + run]))
+            run++;
+        if (run > 1) {
+            builder.append_op(hashop::MEM_FUSED);
+            builder.bytecode.push_back(run);
+            for (size_t k = 0; k < run; k++) {
+                builder.append_op(ir[i + k].op);
+                builder.bytecode.insert(builder.bytecode.end(), ir[i + k].operand.begin(), ir[i + k].operand.end());
+            }
+            i += run - 1;
+            continue;
+        }
+
+        switch (op.op) {
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::MEMADD:
+        case hashop::MEMXOR:
+            builder.append_op(op.op);
+            builder.bytecode.insert(builder.bytecode.end(), op.operand.begin(), op.operand.end());
+            break;
+        case hashop::SHA_SINGLE:
+        case hashop::SHA_LOOP:
+            if (op.count == 1) {
+                builder.append_op(hashop::SHA_SINGLE);
+            } else {
+                builder.append_op(hashop::SHA_LOOP);
+                builder.bytecode.push_back(op.count);
+            }
+            break;
+        case hashop::MEMGEN:
+            builder.append_op(hashop::MEMGEN);
+            builder.append_op(op.memgen_op);
+            builder.bytecode.push_back(op.count);
+            break;
+        case hashop::MEM_SELECT:
+            builder.append_op(hashop::MEM_SELECT);
+            builder.bytecode.push_back(static_cast<uint32_t>(op.region));
+            break;
+        default:
+            builder.append_op(op.op);
+            break;
+        }
+    }
+    return builder;
+}
+
+static inline bool is_zero(const std::array<uint32_t, 8>& operand) {
+    for (uint32_t word : operand)
+        if (word != 0) return false;
+    return true;
+}
+
+// drops ops without effect and merges neighbours of the same kind
+static void fold_ops(program_ir_t& ir) {
+    program_ir_t out{};
+    for (ir_op_t op : ir) {
+        if (op.op == hashop::SHA_SINGLE) op.op = hashop::SHA_LOOP;
+
+        switch (op.op) {
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::MEMADD:
+        case hashop::MEMXOR:
+            if (is_zero(op.operand)) continue;
+            break;
+        case hashop::SHA_LOOP:
+            if (op.count == 0) continue;
+            break;
+        case hashop::MEM_SELECT:
+            if (op.region == memregion::unknown) continue;
+            break;
+        case hashop::UNKNOWN:
+            continue;
+        default:
+            break;
+        }
+
+        if (!out.empty() && out.back().op == op.op) {
+            ir_op_t& prev = out.back();
+            switch (op.op) {
+            case hashop::ADD:
+            case hashop::MEMADD:
+                for (uint32_t i = 0; i < 8; i++)
+                    prev.operand[i] += op.operand[i];
+                continue;
+            case hashop::XOR:
+            case hashop::MEMXOR:
+                for (uint32_t i = 0; i < 8; i++)
+                    prev.operand[i] ^= op.operand[i];
+                continue;
+            case hashop::SHA_LOOP:
+                if (prev.count + op.count < prev.count) break; // would overflow the loop count
+                prev.count += op.count;
+                continue;
+            default:
+                break;
+            }
+        }
+        out.push_back(op);
+    }
+    ir.swap(out);
+}
+
+// pool ops do not touch the running hash, move them down to the READMEM that reads them,
+// drop them if a MEMGEN or the end of the program comes first
+static void sink_mem_ops(program_ir_t& ir, bool keep_unread) {
+    program_ir_t out{};
+    program_ir_t pending{};
+    for (const ir_op_t& op : ir) {
+        if (is_mem_op(op)) {
+            pending.push_back(op);
+            continue;
+        }
+        if (op.op == hashop::MEM_SELECT || keep_unread) {
+            out.insert(out.end(), pending.begin(), pending.end());
+            pending.clear();
+        } else if (op.op == hashop::MEMGEN) {
+            pending.clear();
+        }
+        out.push_back(op);
+    }
+    if (keep_unread) out.insert(out.end(), pending.begin(), pending.end());
+    ir.swap(out);
+}
+
+// drops ops writing the running hash, READMEM included, when a READMEM overwrites it before anything reads it
+static void drop_dead_ops(program_ir_t& ir) {
+    program_ir_t out{};
+    bool dead = false; // the running hash is overwritten before it is read, walking backwards
+    for (auto it = ir.rbegin(); it != ir.rend(); ++it) {
+        switch (it->op) {
+        case hashop::ADD:
+        case hashop::XOR:
+        case hashop::SHA_SINGLE:
+        case hashop::SHA_LOOP:
+            if (dead) continue;
+            break;
+        case hashop::MEM_SELECT:
+            if (dead) continue;
+            if (it->region != memregion::unknown) dead = true;
+            break;
+        case hashop::MEMGEN:
+            dead = false;
+            break;
+        default:
+            break;
+        }
+        out.push_back(*it);
+    }
+    ir.assign(out.rbegin(), out.rend());
+}
+
+void optimize_ir(program_ir_t& ir) {
+    // a MEMGEN that does not hash exposes the pool left by earlier ops, even from the previous nonce
+    bool keep_unread = false;
+    for (const ir_op_t& op : ir)
+        if (op.op == hashop::MEMGEN && op.memgen_op != hashop::SHA_SINGLE) keep_unread = true;
+
+    // every pass only removes ops or reorders pool ops, stop once nothing shrinks
+    size_t size;
+    do {
+        size = ir.size();
+        sink_mem_ops(ir, keep_unread);
+        drop_dead_ops(ir);
+        fold_ops(ir);
+    } while (ir.size() < size);
+}
+
+static const char* memregion_name(memregion region) {
+    switch (region) {
+    case memregion::merkle_root:
+        return "MERKLE";
+    case memregion::prev_hash:
+        return "HASHPREV";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+std::string ir_to_string(const program_ir_t& ir) {
+    std::ostringstream out;
+    for (const ir_op_t& op : ir) {
+        std::array<uint32_t, 8> operand = op.operand;
+        const std::string hex = makeHex((unsigned char*)operand.data(), 32);
+        switch (op.op) {
+        case hashop::ADD:
+            out << "ADD " << hex;
+            break;
+        case hashop::XOR:
+            out << "XOR " << hex;
+            break;
+        case hashop::SHA_SINGLE:
+        case hashop::SHA_LOOP:
+            out << "SHA2";
+            if (op.count != 1) out << " " << op.count;
+            break;
+        case hashop::MEMGEN:
+            out << "MEMGEN " << (op.memgen_op == hashop::SHA_SINGLE ? "SHA2" : "UNKNOWN") << " " << op.count;
+            break;
+        case hashop::MEMADD:
+            out << "MEMADD " << hex;
+            break;
+        case hashop::MEMXOR:
+            out << "MEMXOR " << hex;
+            break;
+        case hashop::MEM_SELECT:
+            out << "READMEM " << memregion_name(op.region);
+            break;
+        default:
+            out << "UNKNOWN";
+            break;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+program_t compile_program(const std::vector<std::string>& program) {
+    program_ir_t ir = bytecode_to_ir(program_to_bytecode(program));
+#ifdef DEBUG_LOGS
+    printf("program:\n%s", ir_to_string(ir).c_str());
+#endif
+    optimize_ir(ir);
+#ifdef DEBUG_LOGS
+    printf("optimized program:\n%s", ir_to_string(ir).c_str());
+#endif
+    return ir_to_bytecode(ir);
+}
+
+void program_t::plan_memgen() {
+    const program_ir_t ir = bytecode_to_ir(*this);
+
+    memgen_plans.clear();
+
+    // a MEMGEN that does not hash leaves older entries readable, keep the full pools then
+    for (const ir_op_t& op : ir)
+        if (op.op == hashop::MEMGEN && op.memgen_op != hashop::SHA_SINGLE) return;
+
+    for (size_t i = 0; i < ir.size(); i++) {
+        if (ir[i].op != hashop::MEMGEN) continue;
+
+        memgen_plan_t plan{};
+        plan.mem_size = ir[i].count;
+
+        // everything up to the next MEMGEN sees this pool
+        uint32_t regions = 0;
+        bool chain_known = false;
+        for (size_t j = i + 1; j < ir.size() && ir[j].op != hashop::MEMGEN; j++) {
+            switch (ir[j].op) {
+            case hashop::ADD:
+            case hashop::XOR:
+            case hashop::SHA_SINGLE:
+            case hashop::SHA_LOOP:
+                if (!chain_known) {
+                    plan.chain_live = true;
+                    chain_known = true;
+                }
+                break;
+            case hashop::MEM_SELECT: {
+                const memregion reg = ir[j].region;
+                if (reg == memregion::unknown) break;
+                regions |= 1u << static_cast<uint32_t>(reg);
+                plan.region = reg;
+                if (!chain_known) {
+                    plan.chain_live = false;
+                    chain_known = true;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        if (plan.mem_size == 0 || (regions & (regions - 1)) != 0) {
+            plan.kind = memgen_kind::full;
+            plan.chain_live = true;
+        } else if (regions == 0) {
+            plan.kind = memgen_kind::unobserved;
+        } else {
+            plan.kind = memgen_kind::single_slot;
+        }
+        memgen_plans.push_back(plan);
+    }
+}
+
+void program_t::resolve_memgen(const char* prev_block_hash, const char* merkle_root) {
+    for (memgen_plan_t& plan : memgen_plans) {
+        if (plan.kind != memgen_kind::single_slot) continue;
+        const char* source = plan.region == memregion::merkle_root ? merkle_root : prev_block_hash;
+        plan.slot = *(uint32_t*)source % plan.mem_size;
+    }
+}
+
+uint32_t program_t::largest_memgen() const {
+    uint32_t largest = 0;
+    for (const ir_op_t& op : bytecode_to_ir(*this))
+        if (op.op == hashop::MEMGEN) largest = std::max(largest, op.count);
+    return largest;
+}
+
+// hashes are kept as raw bytes, the SHA256 chain works on big-endian words
+static inline void load_words(uint32_t* words, const uint32_t* hash, size_t count = 8) {
+    for (size_t i = 0; i < count; i++)
+        words[i] = ReadBE32((const unsigned char*)(hash + i));
+}
+
+static inline void store_words(uint32_t* hash, const uint32_t* words, size_t count = 8) {
+    for (size_t i = 0; i < count; i++)
+        WriteBE32((unsigned char*)(hash + i), words[i]);
+}
+
+// chains in steps of `cancel_t::interval` hashes when there is a `cancel`, stops once it fires
+static inline void chain_words(uint32_t* words, size_t lanes, uint32_t iters, cancel_t* cancel) {
+    while (iters > 0) {
+        if (cancel && cancel->check()) return;
+        const uint32_t n = cancel ? std::min(iters, cancel_t::interval) : iters;
+        if (lanes == 1)
+            SHA256Chain32(words, n);
+        else
+            SHA256Chain32Lanes(words, lanes, n);
+        iters -= n;
+    }
+}
+
+static inline void hash_chain(uint32_t* hash, uint32_t iters, cancel_t* cancel) {
+    uint32_t words[8];
+    load_words(words, hash);
+    chain_words(words, 1, iters, cancel);
+    store_words(hash, words);
+}
+
+// lane-parallel hashes keep word i of lane l at [i * lanes + l], see `SHA256Chain32Lanes`
+static inline void hash_chain_lanes(uint32_t* hash, size_t lanes, uint32_t iters, cancel_t* cancel) {
+    uint32_t words[8 * max_lanes];
+    load_words(words, hash, 8 * lanes);
+    chain_words(words, lanes, iters, cancel);
+    store_words(hash, words, 8 * lanes);
+}
+
 void execute_program(
   unsigned char* output,
   const unsigned char* blockHeader,
@@ -107,10 +507,27 @@ void execute_program(
     // initial input is SHA256 of header data
     CSHA256 ctx;
     ctx.Write(blockHeader, 80);
+    uint32_t header_hash[8];
+    ctx.Finalize((unsigned char*)header_hash);
+
+    execute_program(output, header_hash, program, prev_block_hash, merkle_root, mempool);
+}
+
+void execute_program(
+  unsigned char* output,
+  const uint32_t* header_hash,
+  const program_t& program,
+  const char* prev_block_hash,
+  const char* merkle_root,
+  mempool_t& mempool,
+  cancel_t* cancel) {
     uint32_t temp_result[8];
-    ctx.Finalize((unsigned char*)temp_result);
+    memcpy(temp_result, header_hash, 32);
 
-    uint32_t mem_size = 0; // size of current memory pool
+    uint32_t mem_size = 0;  // size of current memory pool
+    uint32_t mem_first = 0; // entries MEMADD/MEMXOR have to update, see `memgen_plan_t`
+    uint32_t mem_last = 0;
+    size_t memgen_index = 0;
 
     auto reader = program.reader();
     while (!reader.empty()) {
@@ -125,52 +542,79 @@ void execute_program(
                 temp_result[i] ^= reader.pop();
             break;
         case hashop::SHA_SINGLE:
-            ctx.Reset();
-            ctx.Write((unsigned char*)temp_result, 32);
-            ctx.Finalize((unsigned char*)temp_result);
-            break;
-        case hashop::SHA_LOOP: {
-            const uint32_t iters = reader.pop();
-            for (uint32_t i = 0; i < iters; i++) {
-                ctx.Reset();
-                ctx.Write((unsigned char*)temp_result, 32);
-                ctx.Finalize((unsigned char*)temp_result);
-            }
+            hash_chain(temp_result, 1, cancel);
+            break;
+        case hashop::SHA_LOOP:
+            hash_chain(temp_result, reader.pop(), cancel);
             break;
-        }
         case hashop::MEMGEN: {
             const hashop hash_op = reader.read_op();
             const uint32_t new_mem_size = reader.pop();
             mempool.resize(new_mem_size * 32);
             mem_size = new_mem_size;
+            const memgen_plan_t& plan = program.memgen_plan(memgen_index++);
+            mem_first = 0;
+            mem_last = mem_size;
             if (hash_op == hashop::SHA_SINGLE) {
-                for (uint32_t i = 0; i < mem_size; i++) {
-                    ctx.Reset();
-                    ctx.Write((unsigned char*)temp_result, 32);
-                    ctx.Finalize((unsigned char*)temp_result);
-                    memcpy(mempool.get() + i * 8, temp_result, 32);
+                uint32_t words[8];
+                load_words(words, temp_result);
+                switch (plan.kind) {
+                case memgen_kind::full:
+                    for (uint32_t i = 0; i < mem_size; i++) {
+                        if (cancel && i % cancel_t::interval == 0 && cancel->check()) break;
+                        SHA256Chain32(words, 1);
+                        store_words(mempool.get() + i * 8, words);
+                    }
+                    break;
+                case memgen_kind::single_slot:
+                    chain_words(words, 1, plan.slot + 1, cancel);
+                    store_words(mempool.get() + plan.slot * 8, words);
+                    if (plan.chain_live) chain_words(words, 1, mem_size - plan.slot - 1, cancel);
+                    mem_first = plan.slot;
+                    mem_last = plan.slot + 1;
+                    break;
+                case memgen_kind::unobserved:
+                    if (plan.chain_live) chain_words(words, 1, mem_size, cancel);
+                    mem_last = 0;
+                    break;
                 }
+                store_words(temp_result, words);
+                // a cancelled pool is left unfinished, the memory ops skip it
+                if (cancel && cancel->cancelled) mem_last = 0;
             }
             break;
         }
         case hashop::MEMADD:
-            if (mem_size != 0) {
-                for (uint32_t i = 0; i < mem_size; i++) {
-                    for (int j = 0; j < 8; j++)
-                        mempool[i * 8 + j] += reader.get(j);
-                }
+            for (uint32_t i = mem_first; i < mem_last; i++) {
+                for (int j = 0; j < 8; j++)
+                    mempool[i * 8 + j] += reader.get(j);
             }
             reader.adv(8);
             break;
         case hashop::MEMXOR:
-            if (mem_size != 0) {
-                for (uint32_t i = 0; i < mem_size; i++) {
-                    for (int j = 0; j < 8; j++)
-                        mempool[i * 8 + j] ^= reader.get(j);
-                }
+            for (uint32_t i = mem_first; i < mem_last; i++) {
+                for (int j = 0; j < 8; j++)
+                    mempool[i * 8 + j] ^= reader.get(j);
             }
             reader.adv(8);
             break;
+        case hashop::MEM_FUSED: {
+            const uint32_t count = reader.pop();
+            for (uint32_t i = mem_first; i < mem_last; i++) {
+                uint32_t* entry = mempool.get() + i * 8;
+                for (uint32_t k = 0; k < count * 9; k += 9) {
+                    if (static_cast<hashop>(reader.get(k)) == hashop::MEMADD) {
+                        for (int j = 0; j < 8; j++)
+                            entry[j] += reader.get(k + 1 + j);
+                    } else {
+                        for (int j = 0; j < 8; j++)
+                            entry[j] ^= reader.get(k + 1 + j);
+                    }
+                }
+            }
+            reader.adv(count * 9);
+            break;
+        }
         case hashop::MEM_SELECT: {
             const memregion reg = reader.read_memregion();
             switch (reg) {
@@ -197,3 +641,193 @@ void execute_program(
     }
     memcpy(output, temp_result, 32);
 }
+
+void lanes_state_t::load(const uint32_t* header_hashes) {
+    for (size_t lane = 0; lane < lanes; lane++)
+        for (uint32_t i = 0; i < 8; i++)
+            hash[i * lanes + lane] = header_hashes[lane * 8 + i];
+    mem_size = 0;
+    mem_first = 0;
+    mem_last = 0;
+    memgen_index = 0;
+}
+
+void lanes_state_t::store(unsigned char* output) const {
+    uint32_t* out = (uint32_t*)output;
+    for (size_t lane = 0; lane < lanes; lane++)
+        for (uint32_t i = 0; i < 8; i++)
+            out[lane * 8 + i] = hash[i * lanes + lane];
+}
+
+void lanes_state_t::add(const uint32_t* args) {
+    for (uint32_t i = 0; i < 8; i++)
+        for (size_t lane = 0; lane < lanes; lane++)
+            hash[i * lanes + lane] += args[i];
+}
+
+void lanes_state_t::xor_(const uint32_t* args) {
+    for (uint32_t i = 0; i < 8; i++)
+        for (size_t lane = 0; lane < lanes; lane++)
+            hash[i * lanes + lane] ^= args[i];
+}
+
+void lanes_state_t::sha(uint32_t iters) { hash_chain_lanes(hash, lanes, iters, cancel); }
+
+void lanes_state_t::memgen(const uint32_t* args) {
+    const size_t entry_size = 8 * lanes; // words of one memory pool entry across all lanes
+    const hashop hash_op = static_cast<hashop>(args[0]);
+    const uint32_t new_mem_size = args[1];
+    mempool->resize(new_mem_size * entry_size * 4);
+    mem_size = new_mem_size;
+    const memgen_plan_t& plan = program->memgen_plan(memgen_index++);
+    mem_first = 0;
+    mem_last = mem_size;
+    if (hash_op == hashop::SHA_SINGLE) {
+        uint32_t words[8 * max_lanes];
+        load_words(words, hash, entry_size);
+        switch (plan.kind) {
+        case memgen_kind::full:
+            for (uint32_t i = 0; i < mem_size; i++) {
+                if (cancel && i % cancel_t::interval == 0 && cancel->check()) break;
+                SHA256Chain32Lanes(words, lanes, 1);
+                store_words(mempool->get() + i * entry_size, words, entry_size);
+            }
+            break;
+        case memgen_kind::single_slot:
+            chain_words(words, lanes, plan.slot + 1, cancel);
+            store_words(mempool->get() + plan.slot * entry_size, words, entry_size);
+            if (plan.chain_live) chain_words(words, lanes, mem_size - plan.slot - 1, cancel);
+            mem_first = plan.slot;
+            mem_last = plan.slot + 1;
+            break;
+        case memgen_kind::unobserved:
+            if (plan.chain_live) chain_words(words, lanes, mem_size, cancel);
+            mem_last = 0;
+            break;
+        }
+        store_words(hash, words, entry_size);
+        // a cancelled pool is left unfinished, the memory ops skip it
+        if (cancel && cancel->cancelled) mem_last = 0;
+    }
+}
+
+void lanes_state_t::memadd(const uint32_t* args) {
+    for (uint32_t i = mem_first; i < mem_last; i++) {
+        uint32_t* entry = mempool->get() + i * 8 * lanes;
+        for (uint32_t j = 0; j < 8; j++)
+            for (size_t lane = 0; lane < lanes; lane++)
+                entry[j * lanes + lane] += args[j];
+    }
+}
+
+void lanes_state_t::memxor(const uint32_t* args) {
+    for (uint32_t i = mem_first; i < mem_last; i++) {
+        uint32_t* entry = mempool->get() + i * 8 * lanes;
+        for (uint32_t j = 0; j < 8; j++)
+            for (size_t lane = 0; lane < lanes; lane++)
+                entry[j * lanes + lane] ^= args[j];
+    }
+}
+
+void lanes_state_t::mem_fused(const uint32_t* args) {
+    const uint32_t count = args[0];
+    for (uint32_t i = mem_first; i < mem_last; i++) {
+        uint32_t* entry = mempool->get() + i * 8 * lanes;
+        for (uint32_t k = 1; k < 1 + count * 9; k += 9) {
+            const bool add = static_cast<hashop>(args[k]) == hashop::MEMADD;
+            for (uint32_t j = 0; j < 8; j++) {
+                const uint32_t arg = args[k + 1 + j];
+                for (size_t lane = 0; lane < lanes; lane++) {
+                    if (add)
+                        entry[j * lanes + lane] += arg;
+                    else
+                        entry[j * lanes + lane] ^= arg;
+                }
+            }
+        }
+    }
+}
+
+void lanes_state_t::mem_select(const uint32_t* args) {
+    const size_t entry_size = 8 * lanes;
+    switch (static_cast<memregion>(args[0])) {
+    case memregion::merkle_root: {
+        uint32_t v0 = *(uint32_t*)merkle_root;
+        uint32_t index = v0 % mem_size;
+        memcpy(hash, mempool->get() + index * entry_size, entry_size * 4);
+        break;
+    }
+    case memregion::prev_hash: {
+        uint32_t v0 = *(uint32_t*)prev_block_hash;
+        uint32_t index = v0 % mem_size;
+        memcpy(hash, mempool->get() + index * entry_size, entry_size * 4);
+        break;
+    }
+    case memregion::unknown:
+        break;
+    }
+}
+
+void execute_program_lanes(
+  unsigned char* output,
+  const uint32_t* header_hashes,
+  size_t lanes,
+  const program_t& program,
+  const char* prev_block_hash,
+  const char* merkle_root,
+  mempool_t& mempool,
+  cancel_t* cancel) {
+    if (lanes == 1) {
+        execute_program(output, header_hashes, program, prev_block_hash, merkle_root, mempool, cancel);
+        return;
+    }
+
+    lanes_state_t state(lanes, program, prev_block_hash, merkle_root, mempool);
+    state.cancel = cancel;
+    state.load(header_hashes);
+
+    auto reader = program.reader();
+    while (!reader.empty()) {
+        const hashop op = reader.read_op();
+        switch (op) {
+        case hashop::ADD:
+            state.add(reader.args());
+            reader.adv(8);
+            break;
+        case hashop::XOR:
+            state.xor_(reader.args());
+            reader.adv(8);
+            break;
+        case hashop::SHA_SINGLE:
+            state.sha(1);
+            break;
+        case hashop::SHA_LOOP:
+            state.sha(reader.pop());
+            break;
+        case hashop::MEMGEN:
+            state.memgen(reader.args());
+            reader.adv(2);
+            break;
+        case hashop::MEMADD:
+            state.memadd(reader.args());
+            reader.adv(8);
+            break;
+        case hashop::MEMXOR:
+            state.memxor(reader.args());
+            reader.adv(8);
+            break;
+        case hashop::MEM_FUSED:
+            state.mem_fused(reader.args());
+            reader.adv(1 + reader.get(0) * 9);
+            break;
+        case hashop::MEM_SELECT:
+            state.mem_select(reader.args());
+            reader.adv(1);
+            break;
+        case hashop::UNKNOWN:
+            break;
+        }
+    }
+
+    state.store(output);
+}
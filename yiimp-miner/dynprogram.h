@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <limits>
 #include <memory>
 #include <string>
@@ -14,6 +16,7 @@ enum class hashop : uint32_t {
     MEMADD = 5,
     MEMXOR = 6,
     MEM_SELECT = 7,
+    MEM_FUSED = 8, // emitted by `optimize_ir` only: count, then count times MEMADD or MEMXOR and its 8 words
     UNKNOWN = std::numeric_limits<uint32_t>::max(),
 };
 
@@ -23,30 +26,84 @@ enum class memregion : uint32_t {
     unknown = 2,
 };
 
+enum class memgen_kind : uint32_t {
+    full = 0,        // every entry may be read, generate the whole pool
+    single_slot = 1, // only the entry picked by one READMEM region is read
+    unobserved = 2,  // no entry is ever read
+};
+
+// what a MEMGEN has to produce for the rest of the program to see the same values
+struct memgen_plan_t {
+    memgen_kind kind = memgen_kind::full;
+    memregion region = memregion::unknown; // region selecting the slot of a `single_slot` plan
+    bool chain_live = true;                // the last hash of the chain is read after the MEMGEN
+    uint32_t mem_size = 0;
+    uint32_t slot = 0; // depends on the job, see `program_t::resolve_memgen`
+};
+
 struct program_t {
     std::vector<uint32_t> bytecode{};
+    std::vector<memgen_plan_t> memgen_plans{}; // one per MEMGEN, empty if not planned
 
     void append_op(hashop);
     void append_hex_hash(const std::string&);
 
+    // finds out which memory pool entries each MEMGEN has to produce, once per program
+    void plan_memgen();
+    // picks the slots of `single_slot` plans, has to be called for every job
+    void resolve_memgen(const char* prev_block_hash, const char* merkle_root);
+    // entries of the largest MEMGEN, to size the memory pool before hashing
+    uint32_t largest_memgen() const;
+
+    inline const memgen_plan_t& memgen_plan(size_t index) const {
+        static const memgen_plan_t full_plan{};
+        return index < memgen_plans.size() ? memgen_plans[index] : full_plan;
+    }
+
+    // non-owning view of `bytecode`, valid while the program is neither changed nor destroyed
     struct reader_t {
         size_t pos{};
-        std::vector<uint32_t> bytecode{};
+        const uint32_t* bytecode{};
+        size_t size{};
 
-        inline bool empty() const { return pos == bytecode.size(); }
+        inline bool empty() const { return pos == size; }
         inline uint32_t pop() { return bytecode[pos++]; }
         inline uint32_t peek() { return bytecode[pos + 1]; }
         inline uint32_t get(uint32_t index) { return bytecode[pos + index]; }
         inline void adv(uint32_t index) { pos += index; }
+        inline const uint32_t* args() const { return bytecode + pos; }
         inline hashop read_op() { return static_cast<hashop>(pop()); }
         inline memregion read_memregion() { return static_cast<memregion>(pop()); }
     };
 
-    reader_t reader() const { return { .pos = 0, .bytecode = bytecode }; }
+    reader_t reader() const { return { .pos = 0, .bytecode = bytecode.data(), .size = bytecode.size() }; }
 };
 
 program_t program_to_bytecode(const std::vector<std::string>& program);
 
+// one decoded op, MEM_FUSED is split back into its MEMADD/MEMXOR parts
+struct ir_op_t {
+    hashop op = hashop::UNKNOWN;
+    std::array<uint32_t, 8> operand{};     // ADD, XOR, MEMADD, MEMXOR
+    uint32_t count = 0;                    // SHA_LOOP iterations, MEMGEN entries
+    hashop memgen_op = hashop::UNKNOWN;    // MEMGEN
+    memregion region = memregion::unknown; // MEM_SELECT
+};
+
+using program_ir_t = std::vector<ir_op_t>;
+
+program_ir_t bytecode_to_ir(const program_t& program);
+program_t ir_to_bytecode(const program_ir_t& ir);
+
+// rewrites the program into one that gives the same hash with fewer ops
+void optimize_ir(program_ir_t& ir);
+
+// one op per line, in the syntax of the pool programs
+std::string ir_to_string(const program_ir_t& ir);
+
+// parses and optimizes a pool program for the CPU interpreters
+program_t compile_program(const std::vector<std::string>& program);
+
 struct free_delete {
     void operator()(uint32_t* bc) { free(bc); }
 };
@@ -61,18 +118,34 @@ struct mempool_t {
 
     mempool_t(std::size_t size) {
         ptr.reset((uint32_t*)malloc(size));
-        size = size;
+        this->size = size;
     }
 
     inline void resize(std::size_t new_size) {
         if (size >= new_size) return;
         ptr.reset((uint32_t*)realloc(ptr.release(), new_size));
+        size = new_size;
     }
 
     inline uint32_t& operator[](const std::size_t index) const { return ptr.get()[index]; }
     inline uint32_t* get() const { return ptr.get(); }
 };
 
+// lets a worker give up on a hash once its job is replaced; SHA chains and MEMGEN check it every `interval`
+// hashes, once it fires they return at once and the output of the run is meaningless
+struct cancel_t {
+    static constexpr uint32_t interval = 1024;
+
+    const std::atomic<uint32_t>* num = nullptr; // number of the latest job, see `shared_work_t::num`
+    uint32_t job_num = 0;                       // number of the job being hashed
+    bool cancelled = false;
+
+    inline bool check() {
+        if (!cancelled) cancelled = num->load(std::memory_order_relaxed) != job_num;
+        return cancelled;
+    }
+};
+
 void execute_program(
   unsigned char* output,
   const unsigned char* blockHeader,
@@ -80,3 +153,67 @@ void execute_program(
   const char* prev_block_hash,
   const char* merkle_root,
   mempool_t& mempool);
+
+// same as above, starting from the SHA256 of the header (see `SHA256FinalizeHeader`)
+void execute_program(
+  unsigned char* output,
+  const uint32_t* header_hash,
+  const program_t& program,
+  const char* prev_block_hash,
+  const char* merkle_root,
+  mempool_t& mempool,
+  cancel_t* cancel = nullptr);
+
+// largest number of nonces `execute_program_lanes` runs at once
+constexpr std::size_t max_lanes = 8;
+
+// what `execute_program_lanes` keeps between ops, the JIT (see dyn_jit.h) drives it the same way;
+// ops take their arguments as laid out in the bytecode
+struct lanes_state_t {
+    alignas(32) uint32_t hash[8 * max_lanes]; // running hash of each lane, word i of lane l at [i * lanes + l]
+    std::size_t lanes = 1;
+    const program_t* program = nullptr;
+    const char* prev_block_hash = nullptr;
+    const char* merkle_root = nullptr;
+    mempool_t* mempool = nullptr;
+    uint32_t mem_size = 0;  // size of current memory pool
+    uint32_t mem_first = 0; // entries MEMADD/MEMXOR have to update, see `memgen_plan_t`
+    uint32_t mem_last = 0;
+    std::size_t memgen_index = 0;
+    cancel_t* cancel = nullptr; // checked by `sha` and `memgen`, never fires when null
+
+    lanes_state_t(
+      std::size_t lanes,
+      const program_t& program,
+      const char* prev_block_hash,
+      const char* merkle_root,
+      mempool_t& mempool)
+        : lanes(lanes), program(&program), prev_block_hash(prev_block_hash), merkle_root(merkle_root),
+          mempool(&mempool) {}
+
+    // starts a run on `lanes` consecutive header hashes
+    void load(const uint32_t* header_hashes);
+    // writes `lanes` consecutive hashes
+    void store(unsigned char* output) const;
+
+    void add(const uint32_t* args);
+    void xor_(const uint32_t* args);
+    void sha(uint32_t iters);
+    void memgen(const uint32_t* args);
+    void memadd(const uint32_t* args);
+    void memxor(const uint32_t* args);
+    void mem_fused(const uint32_t* args);
+    void mem_select(const uint32_t* args);
+};
+
+// runs the program for `lanes` header hashes in lockstep, the control flow only depends
+// on the program and the job; `header_hashes` and `output` hold `lanes` consecutive hashes
+void execute_program_lanes(
+  unsigned char* output,
+  const uint32_t* header_hashes,
+  std::size_t lanes,
+  const program_t& program,
+  const char* prev_block_hash,
+  const char* merkle_root,
+  mempool_t& mempool,
+  cancel_t* cancel = nullptr);
@@ -0,0 +1,25 @@
+#include "tests/test.h"
+
+#include "core/sha256.h"
+
+std::vector<test_t>& all_tests() {
+    static std::vector<test_t> tests{};
+    return tests;
+}
+
+uint32_t check_failures = 0;
+
+int main() {
+    printf("SHA256 implementation: %s\n", SHA256AutoDetect().c_str());
+
+    uint32_t failed_tests = 0;
+    for (const test_t& test : all_tests()) {
+        const uint32_t before = check_failures;
+        test.run();
+        const bool passed = check_failures == before;
+        if (!passed) failed_tests++;
+        printf("%-40s %s\n", test.name, passed ? "ok" : "FAILED");
+    }
+    printf("%zu tests, %u failed\n", all_tests().size(), failed_tests);
+    return failed_tests == 0 ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// a minimal test runner without dependencies: every TEST registers itself, tests/main.cpp runs them all and
+// fails when a CHECK did; inputs come from a fixed seed so a failure repeats
+struct test_t {
+    const char* name;
+    void (*run)();
+};
+
+std::vector<test_t>& all_tests();
+extern uint32_t check_failures;
+
+#define TEST(name)                                                                      \
+    static void test_##name();                                                          \
+    static const bool test_##name##_registered = (all_tests().push_back({#name, test_##name}), true); \
+    static void test_##name()
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            check_failures++;                                                 \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);  \
+        }                                                                     \
+    } while (0)
+
+inline std::mt19937_64 test_rng(uint64_t seed) { return std::mt19937_64(seed); }
+
+inline void random_bytes(std::mt19937_64& rng, unsigned char* out, std::size_t size) {
+    for (std::size_t i = 0; i < size; i++)
+        out[i] = uint8_t(rng());
+}
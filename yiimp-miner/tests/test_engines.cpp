@@ -0,0 +1,306 @@
+#include "tests/test.h"
+
+#include "core/sha256.h"
+#include "dyn_jit.h"
+#include "dyn_stratum.h"
+#include "dyn_threaded.h"
+#include "dynprogram.h"
+
+#include <cstring>
+#include <string>
+
+// a pool-like program over every op, memory ops only after a MEMGEN
+static std::string random_program(std::mt19937_64& rng) {
+    auto hex = [&rng]() {
+        std::string hex;
+        for (int i = 0; i < 64; i++)
+            hex += "0123456789abcdef"[rng() % 16];
+        return hex;
+    };
+    std::string program{};
+    auto append = [&program](const std::string& op) { program += (program.empty() ? "" : "$") + op; };
+
+    bool mem = false;
+    const int ops = 1 + rng() % 14;
+    for (int i = 0; i < ops; i++) {
+        switch (rng() % 9) {
+        case 0: append("ADD " + hex()); break;
+        case 1: append("XOR " + hex()); break;
+        case 2: append("SHA2"); break;
+        case 3: append("SHA2 " + std::to_string(1 + rng() % 40)); break;
+        case 4:
+            append("MEMGEN SHA2 " + std::to_string(1 + rng() % 70));
+            mem = true;
+            break;
+        case 5:
+            if (mem) append("MEMADD " + hex());
+            break;
+        case 6:
+            if (mem) append("MEMXOR " + hex());
+            break;
+        case 7:
+            if (mem) append("READMEM MERKLE");
+            break;
+        case 8:
+            if (mem) append("READMEM HASHPREV");
+            break;
+        }
+    }
+    return program;
+}
+
+// a random job for a random program
+struct test_job_t {
+    std::vector<std::string> program{};
+    unsigned char header[80];
+    char prev_block_hash[32];
+    char merkle_root[32];
+
+    explicit test_job_t(std::mt19937_64& rng) : program(load_program(random_program(rng), '$')) {
+        random_bytes(rng, header, sizeof(header));
+        random_bytes(rng, (unsigned char*)prev_block_hash, sizeof(prev_block_hash));
+        random_bytes(rng, (unsigned char*)merkle_root, sizeof(merkle_root));
+    }
+
+    void header_hash(uint32_t nonce, uint32_t* hash) {
+        memcpy(header + 76, &nonce, 4);
+        CSHA256().Write(header, sizeof(header)).Finalize((unsigned char*)hash);
+    }
+};
+
+TEST(header_hash_overload_matches_execute_program) {
+    std::mt19937_64 rng = test_rng(2);
+    mempool_t mempool(256 * 32);
+    for (int i = 0; i < 100; i++) {
+        test_job_t job(rng);
+        const program_t program = program_to_bytecode(job.program);
+        for (uint32_t nonce = 0; nonce < 4; nonce++) {
+            uint32_t header_hash[8];
+            job.header_hash(nonce, header_hash);
+            unsigned char expected[32], output[32];
+            execute_program(expected, job.header, program, job.prev_block_hash, job.merkle_root, mempool);
+            execute_program(output, header_hash, program, job.prev_block_hash, job.merkle_root, mempool);
+            CHECK(memcmp(output, expected, 32) == 0);
+        }
+    }
+}
+
+// hashes of nonces `first` to `first + count - 1` by `execute_program`, the reference for every engine
+static std::vector<unsigned char> expected_hashes(test_job_t& job, uint32_t first, std::size_t count) {
+    const program_t program = program_to_bytecode(job.program);
+    mempool_t mempool(256 * 32);
+    std::vector<unsigned char> hashes(32 * count);
+    for (std::size_t i = 0; i < count; i++) {
+        const uint32_t nonce = first + uint32_t(i);
+        memcpy(job.header + 76, &nonce, 4);
+        execute_program(&hashes[32 * i], job.header, program, job.prev_block_hash, job.merkle_root, mempool);
+    }
+    return hashes;
+}
+
+// `count` consecutive header hashes, the input of the lane engines
+static std::vector<uint32_t> header_hashes(test_job_t& job, uint32_t first, std::size_t count) {
+    std::vector<uint32_t> hashes(8 * count);
+    for (std::size_t i = 0; i < count; i++)
+        job.header_hash(first + uint32_t(i), &hashes[8 * i]);
+    return hashes;
+}
+
+TEST(lanes_match_execute_program) {
+    std::mt19937_64 rng = test_rng(5);
+    mempool_t mempool(256 * 32);
+    for (int i = 0; i < 100; i++) {
+        test_job_t job(rng);
+        const program_t program = program_to_bytecode(job.program);
+        const uint32_t first = uint32_t(rng());
+        const std::vector<unsigned char> expected = expected_hashes(job, first, max_lanes);
+        const std::vector<uint32_t> hashes = header_hashes(job, first, max_lanes);
+        for (std::size_t lanes = 1; lanes <= max_lanes; lanes++) {
+            std::vector<unsigned char> output(32 * lanes);
+            execute_program_lanes(
+              output.data(), hashes.data(), lanes, program, job.prev_block_hash, job.merkle_root, mempool);
+            CHECK(memcmp(output.data(), expected.data(), output.size()) == 0);
+        }
+    }
+}
+
+TEST(planned_memgen_matches_execute_program) {
+    std::mt19937_64 rng = test_rng(6);
+    mempool_t mempool(256 * 32);
+    uint32_t kinds[3] = {0};
+    for (int i = 0; i < 200; i++) {
+        test_job_t job(rng);
+        program_t program = program_to_bytecode(job.program);
+        program.plan_memgen();
+        program.resolve_memgen(job.prev_block_hash, job.merkle_root);
+        for (const memgen_plan_t& plan : program.memgen_plans)
+            kinds[uint32_t(plan.kind)]++;
+
+        const uint32_t first = uint32_t(rng());
+        const std::vector<unsigned char> expected = expected_hashes(job, first, max_lanes);
+        const std::vector<uint32_t> hashes = header_hashes(job, first, max_lanes);
+        unsigned char output[32 * max_lanes];
+        execute_program(output, hashes.data(), program, job.prev_block_hash, job.merkle_root, mempool);
+        CHECK(memcmp(output, expected.data(), 32) == 0);
+        execute_program_lanes(
+          output, hashes.data(), max_lanes, program, job.prev_block_hash, job.merkle_root, mempool);
+        CHECK(memcmp(output, expected.data(), sizeof(output)) == 0);
+    }
+    // the programs cover every kind of plan
+    CHECK(kinds[0] != 0 && kinds[1] != 0 && kinds[2] != 0);
+}
+
+TEST(optimized_program_matches_execute_program) {
+    std::mt19937_64 rng = test_rng(7);
+    mempool_t mempool(256 * 32);
+    std::size_t ops = 0, optimized_ops = 0;
+    for (int i = 0; i < 300; i++) {
+        test_job_t job(rng);
+        const program_t plain = program_to_bytecode(job.program);
+        const program_t round_trip = ir_to_bytecode(bytecode_to_ir(plain));
+        program_t program = compile_program(job.program);
+        program.plan_memgen();
+        program.resolve_memgen(job.prev_block_hash, job.merkle_root);
+        ops += bytecode_to_ir(plain).size();
+        optimized_ops += bytecode_to_ir(program).size();
+
+        const uint32_t first = uint32_t(rng());
+        const std::vector<unsigned char> expected = expected_hashes(job, first, max_lanes);
+        const std::vector<uint32_t> hashes = header_hashes(job, first, max_lanes);
+        unsigned char output[32 * max_lanes];
+        execute_program(output, hashes.data(), round_trip, job.prev_block_hash, job.merkle_root, mempool);
+        CHECK(memcmp(output, expected.data(), 32) == 0);
+        execute_program(output, hashes.data(), program, job.prev_block_hash, job.merkle_root, mempool);
+        CHECK(memcmp(output, expected.data(), 32) == 0);
+        execute_program_lanes(
+          output, hashes.data(), max_lanes, program, job.prev_block_hash, job.merkle_root, mempool);
+        CHECK(memcmp(output, expected.data(), sizeof(output)) == 0);
+    }
+    CHECK(optimized_ops < ops);
+}
+
+// big-endian like `work_t::share_target`
+static uint64_t hash_prefix(const unsigned char* hash) {
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++)
+        prefix = prefix << 8 | hash[i];
+    return prefix;
+}
+
+TEST(jit_matches_execute_program) {
+    std::mt19937_64 rng = test_rng(8);
+    mempool_t mempool(256 * 32);
+    for (int i = 0; i < 100; i++) {
+        test_job_t job(rng);
+        program_t program = compile_program(job.program);
+        program.plan_memgen();
+        program.resolve_memgen(job.prev_block_hash, job.merkle_root);
+        const std::size_t lanes = std::size_t(1) << (i % 4);
+        const std::shared_ptr<const jit_program_t> jit =
+          jit_compile(program, lanes, job.prev_block_hash, job.merkle_root);
+#if defined(__x86_64__) && !defined(_WIN32)
+        CHECK(jit != nullptr);
+#endif
+        if (!jit) continue;
+
+        // the code is compiled once per program and runs on later jobs with other memory slots
+        for (int j = 0; j < 2; j++) {
+            if (j != 0) {
+                random_bytes(rng, job.header, sizeof(job.header));
+                random_bytes(rng, (unsigned char*)job.prev_block_hash, sizeof(job.prev_block_hash));
+                random_bytes(rng, (unsigned char*)job.merkle_root, sizeof(job.merkle_root));
+                program.resolve_memgen(job.prev_block_hash, job.merkle_root);
+            }
+            const uint32_t first = uint32_t(rng());
+            const std::vector<unsigned char> expected = expected_hashes(job, first, lanes);
+            const std::vector<uint32_t> hashes = header_hashes(job, first, lanes);
+
+            jit_frame_t frame(lanes, program, job.prev_block_hash, job.merkle_root, mempool);
+            frame.target = hash_prefix(&expected[32 * (rng() % lanes)]);
+            uint32_t expected_found = 0;
+            for (std::size_t lane = 0; lane < lanes; lane++)
+                if (hash_prefix(&expected[32 * lane]) <= frame.target) expected_found |= 1u << lane;
+
+            unsigned char output[32 * max_lanes];
+            CHECK(jit->run(frame, hashes.data()) == expected_found);
+            frame.state.store(output);
+            CHECK(memcmp(output, expected.data(), 32 * lanes) == 0);
+        }
+    }
+}
+
+TEST(threaded_matches_execute_program) {
+    std::mt19937_64 rng = test_rng(9);
+    mempool_t mempool(256 * 32);
+    for (int i = 0; i < 100; i++) {
+        test_job_t job(rng);
+        program_t program = compile_program(job.program);
+        program.plan_memgen();
+        program.resolve_memgen(job.prev_block_hash, job.merkle_root);
+        const std::size_t lanes = 1 + i % max_lanes;
+        const std::shared_ptr<const threaded_program_t> threaded = threaded_compile(program, lanes);
+
+        const uint32_t first = uint32_t(rng());
+        const std::vector<unsigned char> expected = expected_hashes(job, first, lanes);
+        const std::vector<uint32_t> hashes = header_hashes(job, first, lanes);
+        lanes_state_t state(lanes, program, job.prev_block_hash, job.merkle_root, mempool);
+        threaded->run(state, hashes.data());
+        unsigned char output[32 * max_lanes];
+        state.store(output);
+        CHECK(memcmp(output, expected.data(), 32 * lanes) == 0);
+    }
+}
+
+TEST(memory_pool_sized_up_front) {
+    std::mt19937_64 rng = test_rng(10);
+    for (int i = 0; i < 100; i++) {
+        test_job_t job(rng);
+        program_t program = compile_program(job.program);
+        program.plan_memgen();
+        program.resolve_memgen(job.prev_block_hash, job.merkle_root);
+
+        // sized like `cpu_miner` does, hashing must not grow the pool
+        mempool_t mempool(32);
+        mempool.resize(std::size_t(program.largest_memgen()) * 32 * max_lanes);
+        const uint32_t* pool = mempool.get();
+        const std::size_t size = mempool.size;
+        const std::vector<uint32_t> hashes = header_hashes(job, uint32_t(rng()), max_lanes);
+        unsigned char output[32 * max_lanes];
+        execute_program_lanes(
+          output, hashes.data(), max_lanes, program, job.prev_block_hash, job.merkle_root, mempool);
+        CHECK(mempool.get() == pool && mempool.size == size);
+    }
+}
+
+TEST(cancel_stops_stale_hashes) {
+    std::mt19937_64 rng = test_rng(11);
+    mempool_t mempool(32 * 30000 * max_lanes);
+    std::atomic<uint32_t> num{1};
+    for (int i = 0; i < 50; i++) {
+        test_job_t job(rng);
+        const program_t program = program_to_bytecode(job.program);
+        const uint32_t first = uint32_t(rng());
+        const std::vector<unsigned char> expected = expected_hashes(job, first, max_lanes);
+        const std::vector<uint32_t> hashes = header_hashes(job, first, max_lanes);
+
+        // a current job is hashed as without a cancel
+        cancel_t cancel{&num, 1};
+        unsigned char output[32 * max_lanes];
+        execute_program_lanes(
+          output, hashes.data(), max_lanes, program, job.prev_block_hash, job.merkle_root, mempool, &cancel);
+        CHECK(!cancel.cancelled);
+        CHECK(memcmp(output, expected.data(), sizeof(output)) == 0);
+    }
+
+    // a replaced job gives up at the next check instead of running for hours
+    const std::vector<std::string> endless{"SHA2 4000000000", "MEMGEN SHA2 30000", "READMEM MERKLE"};
+    test_job_t job(rng);
+    const program_t program = program_to_bytecode(endless);
+    const std::vector<uint32_t> hashes = header_hashes(job, 0, max_lanes);
+    cancel_t cancel{&num, 0};
+    unsigned char output[32 * max_lanes];
+    execute_program_lanes(
+      output, hashes.data(), max_lanes, program, job.prev_block_hash, job.merkle_root, mempool, &cancel);
+    CHECK(cancel.cancelled);
+    execute_program(output, hashes.data(), program, job.prev_block_hash, job.merkle_root, mempool, &cancel);
+}
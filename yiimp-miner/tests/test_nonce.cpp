@@ -0,0 +1,133 @@
+#include "tests/test.h"
+
+#include "util/nonce.h"
+
+#include <algorithm>
+#include <thread>
+
+TEST(partition_tiles_nonce_space) {
+    for (uint32_t workers : {1, 2, 3, 5, 7, 8, 13, 64, 100, 1000}) {
+        nonce_partition_t partition;
+        partition.workers = workers;
+        CHECK(partition.first(0) == 0);
+        CHECK(partition.last(workers - 1) == uint64_t(1) << 32);
+        for (uint32_t i = 0; i < workers; i++) {
+            CHECK(partition.first(i) < partition.last(i));
+            CHECK(partition.first(i) % 8 == 0);
+            if (i + 1 < workers) CHECK(partition.last(i) == partition.first(i + 1));
+        }
+    }
+}
+
+TEST(partition_offset_keeps_lanes_together) {
+    nonce_partition_t partition;
+    partition.workers = 3;
+    CHECK(partition.offset % 8 == 0);
+    // the rotation is a bijection of the 32-bit nonces
+    CHECK(partition.nonce(0) == partition.offset);
+    CHECK(partition.nonce((uint64_t(1) << 32) - 1) == partition.offset - 1);
+    CHECK(partition.nonce(partition.first(1)) % 8 == 0);
+}
+
+// the batches cover [0, 2^32) exactly once, on multiples of 8
+static bool tile_nonce_space(std::vector<nonce_batch_t> batches) {
+    std::sort(batches.begin(), batches.end(), [](const nonce_batch_t& a, const nonce_batch_t& b) {
+        return a.first < b.first;
+    });
+    uint64_t pos = 0;
+    for (const nonce_batch_t& batch : batches) {
+        if (batch.first != pos || batch.empty() || batch.first % 8 != 0 || batch.last % 8 != 0) return false;
+        pos = batch.last;
+    }
+    return pos == uint64_t(1) << 32;
+}
+
+TEST(scheduler_covers_nonce_space_alone) {
+    nonce_partition_t partition;
+    partition.workers = 5;
+    nonce_scheduler_t nonces(partition);
+
+    // one worker takes everything, all but its own range by stealing
+    std::vector<nonce_batch_t> batches;
+    for (nonce_batch_t batch; !(batch = nonces.take(2, uint64_t(1) << 22)).empty();)
+        batches.push_back(batch);
+    CHECK(tile_nonce_space(batches));
+    for (uint32_t i = 0; i < partition.workers; i++)
+        CHECK(nonces.take(i, 8).empty());
+}
+
+TEST(scheduler_covers_nonce_space_with_threads) {
+    nonce_partition_t partition;
+    partition.workers = 8;
+    nonce_scheduler_t nonces(partition);
+
+    std::vector<std::vector<nonce_batch_t>> taken(partition.workers);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < partition.workers; i++) {
+        threads.emplace_back([&nonces, &taken, i]() {
+            std::mt19937_64 rng = test_rng(100 + i);
+            while (true) {
+                // uneven sizes and a slow worker make the others steal
+                const nonce_batch_t batch = nonces.take(i, 1 + rng() % (uint64_t(1) << (i == 0 ? 14 : 22)));
+                if (batch.empty()) break;
+                taken[i].push_back(batch);
+                if (i == 0) std::this_thread::yield();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::vector<nonce_batch_t> batches;
+    uint32_t stolen = 0;
+    for (uint32_t i = 0; i < partition.workers; i++) {
+        for (const nonce_batch_t& batch : taken[i]) {
+            batches.push_back(batch);
+            if (batch.first < partition.first(i) || batch.last > partition.last(i)) stolen++;
+        }
+    }
+    CHECK(tile_nonce_space(batches));
+    CHECK(stolen != 0);
+}
+
+TEST(scheduler_takes_back_left_batches) {
+    nonce_partition_t partition;
+    partition.workers = 8;
+    nonce_scheduler_t nonces(partition);
+
+    const nonce_batch_t batch = nonces.take(3, 64);
+    CHECK(batch.first == partition.first(3) && batch.size() == 64);
+    nonces.give_back(3, nonce_batch_t{batch.first + 16, batch.last});
+    const nonce_batch_t again = nonces.take(3, 64);
+    CHECK(again.first == batch.first + 16 && again.size() == 64);
+
+    // workers that leave a job after part of a batch, e.g. on a difficulty change, and come back to it
+    std::vector<std::vector<nonce_batch_t>> hashed(partition.workers);
+    hashed[3].push_back({batch.first, batch.first + 16});
+    hashed[3].push_back(again);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < partition.workers; i++) {
+        threads.emplace_back([&nonces, &hashed, i]() {
+            std::mt19937_64 rng = test_rng(200 + i);
+            while (true) {
+                nonce_batch_t batch = nonces.take(i, 1 + rng() % (uint64_t(1) << 22));
+                if (batch.empty()) break;
+                if (rng() % 4 == 0) {
+                    const uint64_t done = (rng() % batch.size()) & ~uint64_t(7);
+                    if (done != 0) hashed[i].push_back({batch.first, batch.first + done});
+                    batch.first += done;
+                    nonces.give_back(i, batch);
+                } else {
+                    hashed[i].push_back(batch);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::vector<nonce_batch_t> batches;
+    for (const std::vector<nonce_batch_t>& worker : hashed)
+        batches.insert(batches.end(), worker.begin(), worker.end());
+    CHECK(tile_nonce_space(batches));
+}
@@ -0,0 +1,69 @@
+#include "tests/test.h"
+
+#include "core/sha256.h"
+
+#include <cstring>
+
+TEST(header_midstate_matches_sha256) {
+    std::mt19937_64 rng = test_rng(1);
+    for (int round = 0; round < 200; round++) {
+        unsigned char header[80];
+        random_bytes(rng, header, sizeof(header));
+        SHA256HeaderMidstate midstate;
+        SHA256PrepareHeader(midstate, header);
+
+        for (int i = 0; i < 16; i++) {
+            const uint32_t nonce = i < 2 ? uint32_t(0) - i : uint32_t(rng());
+            memcpy(header + 76, &nonce, 4);
+            unsigned char expected[32], hash[32];
+            CSHA256().Write(header, sizeof(header)).Finalize(expected);
+            SHA256FinalizeHeader(hash, midstate, nonce);
+            CHECK(memcmp(hash, expected, 32) == 0);
+        }
+    }
+}
+
+// `words` as 8 big-endian words, the form SHA256Chain32 works on
+static void to_words(const unsigned char* bytes, uint32_t* words) {
+    for (int i = 0; i < 8; i++)
+        words[i] = uint32_t(bytes[4 * i]) << 24 | uint32_t(bytes[4 * i + 1]) << 16 | uint32_t(bytes[4 * i + 2]) << 8 |
+                   bytes[4 * i + 3];
+}
+
+TEST(chain32_matches_sha256) {
+    std::mt19937_64 rng = test_rng(3);
+    for (uint32_t iters = 0; iters < 70; iters++) {
+        unsigned char message[32];
+        random_bytes(rng, message, sizeof(message));
+        uint32_t words[8];
+        to_words(message, words);
+
+        for (uint32_t i = 0; i < iters; i++)
+            CSHA256().Write(message, 32).Finalize(message);
+        uint32_t expected[8];
+        to_words(message, expected);
+
+        SHA256Chain32(words, iters);
+        CHECK(memcmp(words, expected, sizeof(words)) == 0);
+    }
+}
+
+TEST(chain32_lanes_match_chain32) {
+    std::mt19937_64 rng = test_rng(4);
+    for (size_t lanes = 1; lanes <= 17; lanes++) {
+        const uint32_t iters = rng() % 20;
+        std::vector<uint32_t> words(8 * lanes), expected(8 * lanes);
+        for (size_t l = 0; l < lanes; l++) {
+            uint32_t lane[8];
+            for (int i = 0; i < 8; i++) {
+                lane[i] = uint32_t(rng());
+                words[i * lanes + l] = lane[i];
+            }
+            SHA256Chain32(lane, iters);
+            for (int i = 0; i < 8; i++)
+                expected[i * lanes + l] = lane[i];
+        }
+        SHA256Chain32Lanes(words.data(), lanes, iters);
+        CHECK(words == expected);
+    }
+}
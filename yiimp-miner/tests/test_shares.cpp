@@ -0,0 +1,90 @@
+#include "tests/test.h"
+
+#include "dyn_stratum.h"
+
+#include <thread>
+
+TEST(share_ring_is_fifo_and_bounded) {
+    share_ring_t<8> ring;
+    CHECK(!ring.pop());
+    for (int round = 0; round < 3; round++) {
+        for (uint32_t i = 0; i < 8; i++) {
+            share_t share;
+            share.nonce = round * 8 + i;
+            CHECK(ring.push(share));
+        }
+        CHECK(!ring.push(share_t{}));
+        for (uint32_t i = 0; i < 8; i++) {
+            const std::optional<share_t> share = ring.pop();
+            CHECK(share && share->nonce == round * 8 + i);
+        }
+        CHECK(!ring.pop());
+    }
+}
+
+TEST(share_ring_keeps_every_share) {
+    constexpr uint32_t producers = 4;
+    constexpr uint32_t per_producer = 200000;
+    share_ring_t<64> ring;
+
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; p++) {
+        threads.emplace_back([&ring, p]() {
+            for (uint32_t i = 0; i < per_producer; i++) {
+                share_t share;
+                share.job_num = p;
+                share.nonce = i;
+                while (!ring.push(share))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    // every producer's shares arrive once and in the order it pushed them
+    std::vector<uint32_t> next(producers, 0);
+    bool in_order = true;
+    for (uint64_t popped = 0; popped < uint64_t(producers) * per_producer;) {
+        const std::optional<share_t> share = ring.pop();
+        if (!share) {
+            std::this_thread::yield();
+            continue;
+        }
+        in_order = in_order && share->job_num < producers && share->nonce == next[share->job_num];
+        if (share->job_num < producers) next[share->job_num]++;
+        popped++;
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    CHECK(in_order);
+    CHECK(!ring.pop());
+}
+
+TEST(shares_count_dropped_shares) {
+    static shares_t shares;
+    for (uint32_t i = 0; i < 10000; i++)
+        shares.append(share_t{});
+    CHECK(shares.stats.dropped_share_count != 0);
+    CHECK(shares.stats.share_count + shares.stats.dropped_share_count == 10000);
+    uint64_t popped = 0;
+    while (shares.pop())
+        popped++;
+    CHECK(popped == shares.stats.share_count);
+}
+
+TEST(shared_work_finds_recent_snapshots) {
+    static shared_work_t shared_work;
+    for (uint32_t i = 0; i < 100; i++) {
+        work_t work;
+        work.job_id = std::to_string(i);
+        shared_work.publish(std::move(work));
+    }
+    CHECK(shared_work.snapshot()->num == 100 && shared_work.snapshot()->job_id == "99");
+    for (uint32_t num = 1; num <= 100; num++) {
+        const std::shared_ptr<const work_t> found = shared_work.find(num);
+        if (num > 100 - shared_work_t::recent_size) {
+            CHECK(found && found->num == num && found->job_id == std::to_string(num - 1));
+        } else {
+            CHECK(!found);
+        }
+    }
+}
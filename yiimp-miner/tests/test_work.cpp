@@ -0,0 +1,218 @@
+#include "tests/test.h"
+
+#include "core/sha256.h"
+#include "dyn_stratum.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+
+// a job as set_job leaves it, with a random header, coinbase and merkle branch
+static work_t random_work(std::mt19937_64& rng, uint32_t extranonce2_size) {
+    work_t work;
+    random_bytes(rng, work.native_data, sizeof(work.native_data));
+    memcpy(work.prev_block_hash, work.native_data + 4, 32);
+    auto random_vector = [&rng](std::size_t size) {
+        std::vector<unsigned char> bytes(size);
+        random_bytes(rng, bytes.data(), size);
+        return bytes;
+    };
+    auto coinbase = std::make_shared<coinbase_t>();
+    coinbase->coinb1 = random_vector(40 + rng() % 60);
+    coinbase->coinb2 = random_vector(40 + rng() % 60);
+    coinbase->extranonce1 = random_vector(4);
+    coinbase->extranonce2_size = extranonce2_size;
+    coinbase->merkle_branch.resize(rng() % 5);
+    for (std::array<unsigned char, 32>& branch : coinbase->merkle_branch)
+        random_bytes(rng, branch.data(), 32);
+    work.coinbase = coinbase;
+    work.set_merkle_root();
+    work.set_program("SHA2$MEMGEN SHA2 64$MEMADD " + std::string(64, '7') + "$READMEM MERKLE$SHA2 3");
+    return work;
+}
+
+// the merkle root of `extranonce2`, hashed byte by byte without the miner's helpers
+static std::array<unsigned char, 32> expected_root(const coinbase_t& parts, uint64_t extranonce2) {
+    std::vector<unsigned char> coinbase = parts.coinb1;
+    coinbase.insert(coinbase.end(), parts.extranonce1.begin(), parts.extranonce1.end());
+    for (uint32_t i = 0; i < parts.extranonce2_size; i++) {
+        const uint32_t shift = 8 * (parts.extranonce2_size - 1 - i);
+        coinbase.push_back(shift < 64 ? uint8_t(extranonce2 >> shift) : 0);
+    }
+    coinbase.insert(coinbase.end(), parts.coinb2.begin(), parts.coinb2.end());
+
+    unsigned char node[64];
+    CSHA256().Write(coinbase.data(), coinbase.size()).Finalize(node);
+    CSHA256().Write(node, 32).Finalize(node);
+    for (const std::array<unsigned char, 32>& branch : parts.merkle_branch) {
+        memcpy(node + 32, branch.data(), 32);
+        CSHA256().Write(node, 64).Finalize(node);
+        CSHA256().Write(node, 32).Finalize(node);
+    }
+    std::array<unsigned char, 32> root;
+    memcpy(root.data(), node, 32);
+    return root;
+}
+
+static std::array<unsigned char, 32> expected_root(const work_t& work) {
+    return expected_root(*work.coinbase, work.extranonce2);
+}
+
+// the header holds the expected root, the midstate finishes to the SHA256 of the header and the program hashes
+// with the memory slots of the root
+static bool header_rebuilt(const work_t& work, const std::array<unsigned char, 32>& root, uint32_t nonce) {
+    bool ok = memcmp(work.native_data + 36, root.data(), 32) == 0;
+    for (int i = 0; i < 32; i++)
+        ok = ok && (unsigned char)work.merkle_root[i] == root[31 - i];
+
+    unsigned char header[80], expected[32], hash[32];
+    memcpy(header, work.native_data, 80);
+    memcpy(header + 76, &nonce, 4);
+    CSHA256().Write(header, 80).Finalize(expected);
+    SHA256FinalizeHeader(hash, work.midstate, nonce);
+    ok = ok && memcmp(hash, expected, 32) == 0;
+
+    // the READMEM slots of the planned program follow the merkle root
+    mempool_t planned_pool(64 * 32), pool(64 * 32);
+    memset(planned_pool.get(), 0, 64 * 32);
+    execute_program(hash, header, work.cpu_program, work.prev_block_hash, work.merkle_root, planned_pool);
+    const program_t plain = program_to_bytecode(work.program);
+    execute_program(expected, header, plain, work.prev_block_hash, work.merkle_root, pool);
+    return ok && memcmp(hash, expected, 32) == 0;
+}
+
+TEST(merkle_roots_match_single_roots) {
+    std::mt19937_64 rng = test_rng(22);
+    for (uint32_t extranonce2_size : {1, 4, 12}) {
+        const work_t work = random_work(rng, extranonce2_size);
+        const coinbase_t& coinbase = *work.coinbase;
+        // a batch from the start, one in the middle and one ending at the largest extranonce2
+        const uint64_t last = coinbase.last_extranonce2();
+        for (uint64_t first : {uint64_t(0), uint64_t(rng() % 200), last - 9}) {
+            const std::size_t count = std::size_t(std::min<uint64_t>(last - first, 70) + 1);
+            std::vector<unsigned char> roots(count * 32);
+            coinbase.merkle_roots(roots.data(), first, count);
+            for (std::size_t i = 0; i < count; i++)
+                CHECK(memcmp(roots.data() + i * 32, expected_root(coinbase, first + i).data(), 32) == 0);
+        }
+    }
+}
+
+TEST(extranonce2_roll_rebuilds_header) {
+    std::mt19937_64 rng = test_rng(20);
+    for (uint32_t extranonce2_size : {1, 4, 8, 12}) {
+        work_t work = random_work(rng, extranonce2_size);
+        merkle_roots_t roots;
+        std::set<std::string> headers{std::string((const char*)work.native_data, 80)};
+        CHECK(header_rebuilt(work, expected_root(work), uint32_t(rng())));
+        // past the first batch of cached roots
+        for (uint64_t roll = 1; roll <= merkle_roots_t::batch + 6; roll++) {
+            CHECK(work.has_next_extranonce2());
+            work.roll_extranonce2(roots);
+            CHECK(work.extranonce2 == roll);
+            CHECK(work.hex_extranonce2().size() == 2 * extranonce2_size);
+            CHECK(header_rebuilt(work, expected_root(work), uint32_t(rng())));
+            headers.insert(std::string((const char*)work.native_data, 80));
+        }
+        CHECK(headers.size() == merkle_roots_t::batch + 7);
+    }
+}
+
+TEST(extranonce2_roll_stops_at_its_size) {
+    std::mt19937_64 rng = test_rng(21);
+    work_t none = random_work(rng, 0);
+    CHECK(!none.has_next_extranonce2());
+
+    work_t one_byte = random_work(rng, 1);
+    merkle_roots_t roots;
+    uint32_t rolls = 0;
+    while (one_byte.has_next_extranonce2()) {
+        one_byte.roll_extranonce2(roots);
+        rolls++;
+    }
+    CHECK(rolls == 255 && one_byte.extranonce2 == 255 && one_byte.hex_extranonce2() == "ff");
+    CHECK(header_rebuilt(one_byte, expected_root(one_byte), uint32_t(rng())));
+}
+
+TEST(version_roll_visits_every_mask_value) {
+    std::mt19937_64 rng = test_rng(23);
+    work_t work = random_work(rng, 4);
+    work.version = uint32_t(rng());
+    work.version_mask = 0x1e000000 | 0x00a00000 | 0x00001200; // 8 bits in three groups
+    work.set_version();
+    work.set_merkle_root();
+    const std::array<unsigned char, 32> root = expected_root(work);
+
+    std::set<uint32_t> versions;
+    auto header_version = [&work]() {
+        uint32_t version;
+        memcpy(&version, work.native_data, 4);
+        return version;
+    };
+    versions.insert(header_version());
+    while (work.has_next_version()) {
+        work.roll_version();
+        const uint32_t version = header_version();
+        CHECK((work.version_bits & ~work.version_mask) == 0);
+        CHECK((version & ~work.version_mask) == (work.version & ~work.version_mask));
+        CHECK((version & work.version_mask) == work.version_bits);
+        CHECK(header_rebuilt(work, root, uint32_t(rng())));
+        versions.insert(version);
+    }
+    CHECK(versions.size() == 256 && work.version_bits == work.version_mask);
+
+    // a new extranonce2 starts again from the job's version bits
+    merkle_roots_t roots;
+    work.roll_extranonce2(roots);
+    CHECK(work.version_bits == 0 && header_version() == (work.version & ~work.version_mask));
+    CHECK(header_rebuilt(work, expected_root(work), uint32_t(rng())));
+}
+
+TEST(version_roll_needs_a_mask) {
+    std::mt19937_64 rng = test_rng(24);
+    work_t work = random_work(rng, 4);
+    CHECK(!work.has_next_version());
+}
+
+TEST(ntime_roll_stays_in_its_window) {
+    std::mt19937_64 rng = test_rng(25);
+    work_t work = random_work(rng, 4);
+    work.ntime = uint32_t(rng());
+    work.ntime_window = 5;
+    work.version_mask = 0x00006000;
+    work.set_ntime();
+    work.set_version();
+    work.set_merkle_root();
+    const std::array<unsigned char, 32> root = expected_root(work);
+
+    auto header_ntime = [&work]() {
+        uint32_t ntime;
+        memcpy(&ntime, work.native_data + 68, 4);
+        return ntime;
+    };
+    std::set<std::string> headers{std::string((const char*)work.native_data, 80)};
+    for (uint32_t roll = 1; roll <= 5; roll++) {
+        while (work.has_next_version()) {
+            work.roll_version();
+            headers.insert(std::string((const char*)work.native_data, 80));
+        }
+        CHECK(work.has_next_ntime());
+        work.roll_ntime();
+        CHECK(work.version_bits == 0);
+        CHECK(header_ntime() == work.ntime + roll);
+        CHECK(strtoul(work.hex_ntime.c_str(), nullptr, 16) == work.ntime + roll);
+        CHECK(header_rebuilt(work, root, uint32_t(rng())));
+        headers.insert(std::string((const char*)work.native_data, 80));
+    }
+    CHECK(!work.has_next_ntime());
+    CHECK(headers.size() == 5 * 4 + 1);
+
+    // a new extranonce2 goes back to the job's ntime
+    merkle_roots_t roots;
+    work.roll_extranonce2(roots);
+    CHECK(header_ntime() == work.ntime && strtoul(work.hex_ntime.c_str(), nullptr, 16) == work.ntime);
+    CHECK(header_rebuilt(work, expected_root(work), uint32_t(rng())));
+}
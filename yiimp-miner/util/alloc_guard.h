@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+// Built with ALLOC_GUARD defined, the allocator counts what the current thread allocates while an
+// `alloc_guard_t` is alive and the guard aborts when it goes out of scope with a non-zero count.
+// The counting allocator is defined in dyn_miner.cpp.
+struct alloc_guard_t {
+    static inline thread_local bool active = false;
+    static inline thread_local std::size_t allocations = 0;
+
+    const char* scope;
+
+    alloc_guard_t(const char* scope) : scope(scope) {
+        allocations = 0;
+        active = true;
+    }
+
+    ~alloc_guard_t() {
+        active = false;
+        if (allocations != 0) {
+            printf("%s: %zu heap allocations\n", scope, allocations);
+            abort();
+        }
+    }
+
+    static inline void count() {
+        if (active) allocations++;
+    }
+};
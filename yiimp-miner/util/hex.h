@@ -81,3 +81,8 @@ inline bool hex2bin(unsigned char* p, const char* hexstr, size_t len) {
     return true;
 }
 
+inline std::vector<unsigned char> hex2bytes(const std::string& hex) {
+    std::vector<unsigned char> bytes(hex.size() / 2);
+    hex2bin(bytes.data(), hex.c_str(), bytes.size());
+    return bytes;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+
+// splits the 32-bit nonce space of a job into disjoint ranges, one per CPU thread or GPU; ranges start and
+// end on multiples of 8 so a batch of SIMD lanes never straddles two of them
+struct nonce_partition_t {
+    uint32_t offset = std::random_device{}() & ~7u; // rotates all ranges, separate processes start apart
+    uint32_t workers = 1;
+
+    // positions [first, last) belong to worker `index`
+    inline uint64_t first(uint32_t index) const { return ((uint64_t(index) << 32) / workers) & ~uint64_t(7); }
+    inline uint64_t last(uint32_t index) const { return first(index + 1); }
+
+    inline uint32_t nonce(uint64_t pos) const { return uint32_t(pos + offset); }
+};
+
+// positions [first, last), see `nonce_partition_t::nonce`
+struct nonce_batch_t {
+    uint64_t first = 0;
+    uint64_t last = 0;
+
+    inline bool empty() const { return first >= last; }
+    inline uint64_t size() const { return empty() ? 0 : last - first; }
+};
+
+// hands out the nonces of one job in batches: a worker takes batches from the front of its range of the
+// partition and, once that is used up, steals the back half of the largest range left
+struct nonce_scheduler_t {
+    struct alignas(64) range_t {
+        std::mutex mutex{};
+        std::atomic<uint64_t> first{}; // written under `mutex`, read without it to pick a range to steal from
+        std::atomic<uint64_t> last{};
+
+        inline uint64_t remaining() const {
+            const uint64_t f = first.load(std::memory_order_relaxed);
+            const uint64_t l = last.load(std::memory_order_relaxed);
+            return l > f ? l - f : 0;
+        }
+    };
+
+    nonce_partition_t partition;
+    std::unique_ptr<range_t[]> ranges;
+    std::atomic_flag exhausted = ATOMIC_FLAG_INIT; // set by the first worker that finds nothing left
+
+    explicit nonce_scheduler_t(const nonce_partition_t& partition)
+        : partition(partition), ranges(new range_t[partition.workers]) {
+        for (uint32_t i = 0; i < partition.workers; i++) {
+            ranges[i].first = partition.first(i);
+            ranges[i].last = partition.last(i);
+        }
+    }
+
+    inline uint32_t nonce(uint64_t pos) const { return partition.nonce(pos); }
+
+    // up to `size` nonces for worker `index`, empty once every nonce of the job is handed out
+    nonce_batch_t take(uint32_t index, uint64_t size) {
+        size = (size + 7) & ~uint64_t(7);
+        range_t& own = ranges[index];
+        while (true) {
+            {
+                std::unique_lock<std::mutex> _lock(own.mutex);
+                const uint64_t first = own.first.load(std::memory_order_relaxed);
+                const uint64_t last = own.last.load(std::memory_order_relaxed);
+                if (first < last) {
+                    const nonce_batch_t batch{first, std::min(first + size, last)};
+                    own.first.store(batch.last, std::memory_order_relaxed);
+                    return batch;
+                }
+            }
+            if (!steal(index)) return {};
+        }
+    }
+
+    // returns the unhashed rest of worker `index`'s latest batch, for a worker that leaves a job which lives on in
+    // a new snapshot, e.g. after a difficulty change; the batch came from the front of the worker's range and
+    // only the worker moves that front, so the rest fits right before it
+    void give_back(uint32_t index, const nonce_batch_t& batch) {
+        if (batch.empty()) return;
+        std::unique_lock<std::mutex> _lock(ranges[index].mutex);
+        ranges[index].first.store(batch.first, std::memory_order_relaxed);
+    }
+
+    // moves the back half of the largest other range to worker `index`, false when nothing is left; the
+    // stolen nonces are in the thief's range before they leave the victim's, so a scan never misses them
+    bool steal(uint32_t index) {
+        while (true) {
+            uint32_t victim = index;
+            uint64_t largest = 0;
+            for (uint32_t i = 0; i < partition.workers; i++) {
+                const uint64_t remaining = ranges[i].remaining();
+                if (i != index && remaining > largest) {
+                    victim = i;
+                    largest = remaining;
+                }
+            }
+            if (largest == 0) {
+                // the scan reads the ranges one by one, a steal between two reads can hide nonces from it
+                if (all_empty()) return false;
+                continue;
+            }
+
+            // both ranges are locked in index order, see `all_empty`
+            std::unique_lock<std::mutex> _lock_low(ranges[std::min(index, victim)].mutex);
+            std::unique_lock<std::mutex> _lock_high(ranges[std::max(index, victim)].mutex);
+            const uint64_t victim_first = ranges[victim].first.load(std::memory_order_relaxed);
+            const uint64_t last = ranges[victim].last.load(std::memory_order_relaxed);
+            if (victim_first >= last) continue; // taken meanwhile, look again
+            // a range of 8 is taken whole
+            uint64_t first = std::max(victim_first, last - (((last - victim_first) / 2) & ~uint64_t(7)));
+            if (first == last) first = victim_first;
+            ranges[index].last.store(last, std::memory_order_relaxed);
+            ranges[index].first.store(first, std::memory_order_relaxed);
+            ranges[victim].last.store(first, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // with every range locked, in index order like `steal`
+    bool all_empty() {
+        for (uint32_t i = 0; i < partition.workers; i++) ranges[i].mutex.lock();
+        bool empty = true;
+        for (uint32_t i = 0; i < partition.workers; i++) empty = empty && ranges[i].remaining() == 0;
+        for (uint32_t i = 0; i < partition.workers; i++) ranges[i].mutex.unlock();
+        return empty;
+    }
+};
+
+// sizes a worker's batches to take it about `target`, from the throughput it measured on the last one
+struct batch_sizer_t {
+    uint64_t granule; // batches are multiples of it
+    std::chrono::duration<double> target;
+    uint64_t size;
+    uint64_t started_size = 0;
+    std::chrono::steady_clock::time_point started{};
+
+    batch_sizer_t(uint64_t granule, std::chrono::duration<double> target)
+        : granule(granule), target(target), size(granule) {}
+
+    // before hashing a batch of `n` nonces
+    inline void start(uint64_t n) {
+        started_size = n;
+        started = std::chrono::steady_clock::now();
+    }
+
+    // after hashing the batch of `start`
+    inline void finish() {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        if (started_size == 0 || elapsed.count() <= 0) return;
+        const double wanted = started_size / elapsed.count() * target.count();
+        // grows at most 4x per batch so one fast measurement does not hand out a huge batch
+        size = std::clamp<uint64_t>(uint64_t(wanted) / granule * granule, granule, size * 4);
+        started_size = 0;
+    }
+};
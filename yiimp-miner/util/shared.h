@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+// a shared_ptr that one thread replaces while others load it; a small lock instead of
+// std::atomic<std::shared_ptr>, which needs libstdc++ 12
+template <typename T>
+struct locked_shared_ptr_t {
+    locked_shared_ptr_t() = default;
+    locked_shared_ptr_t(std::shared_ptr<T> ptr) : ptr(std::move(ptr)) {}
+
+    inline std::shared_ptr<T> load() const {
+        std::unique_lock<std::mutex> _lock(mutex);
+        return ptr;
+    }
+
+    // the old object is released after the lock, its destructor may be slow
+    inline void store(std::shared_ptr<T> new_ptr) {
+        {
+            std::unique_lock<std::mutex> _lock(mutex);
+            ptr.swap(new_ptr);
+        }
+    }
+
+private:
+    mutable std::mutex mutex{};
+    std::shared_ptr<T> ptr{};
+};
@@ -5,6 +5,7 @@
 #include "version.h"
 
 #include <string>
+#include <vector>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -35,6 +36,21 @@ constexpr double kb = 1024;
 
 static std::string seconds_to_uptime(int n);
 
+static void format_hashrate(char* display, double hashrate) {
+    if (hashrate >= tb)
+        sprintf(display, "%.2f TH/s", (double)hashrate / tb);
+    else if (hashrate >= gb && hashrate < tb)
+        sprintf(display, "%.2f GH/s", (double)hashrate / gb);
+    else if (hashrate >= mb && hashrate < gb)
+        sprintf(display, "%.2f MH/s", (double)hashrate / mb);
+    else if (hashrate >= kb && hashrate < mb)
+        sprintf(display, "%.2f KH/s", (double)hashrate / kb);
+    else if (hashrate < kb)
+        sprintf(display, "%.2f H/s ", hashrate);
+    else
+        sprintf(display, "%.2f H/s", hashrate);
+}
+
 #ifdef _WIN32
 #define SET_COLOR(color) SetConsoleTextAttribute(hConsole, color);
 #else
@@ -45,7 +61,7 @@ static bool output_stats(time_t now, time_t start, stats_t& stats) {
 #ifdef _WIN32
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
 #endif
-    uint64_t nonce = stats.nonce_count.load(std::memory_order_relaxed);
+    uint64_t nonce = stats.nonce_count();
 
     struct tm* timeinfo;
     char timestamp[80];
@@ -53,18 +69,7 @@ static bool output_stats(time_t now, time_t start, stats_t& stats) {
     strftime(timestamp, 80, "%F %T", timeinfo);
     char display[256];
     double hashrate = (double)nonce / (double)(now - start);
-    if (hashrate >= tb)
-        sprintf(display, "%.2f TH/s", (double)hashrate / tb);
-    else if (hashrate >= gb && hashrate < tb)
-        sprintf(display, "%.2f GH/s", (double)hashrate / gb);
-    else if (hashrate >= mb && hashrate < gb)
-        sprintf(display, "%.2f MH/s", (double)hashrate / mb);
-    else if (hashrate >= kb && hashrate < mb)
-        sprintf(display, "%.2f KH/s", (double)hashrate / kb);
-    else if (hashrate < kb)
-        sprintf(display, "%.2f H/s ", hashrate);
-    else
-        sprintf(display, "%.2f H/s", hashrate);
+    format_hashrate(display, hashrate);
 
     std::string uptime = seconds_to_uptime(difftime(now, start));
 
@@ -107,6 +112,47 @@ static bool output_stats(time_t now, time_t start, stats_t& stats) {
     return (true);
 }
 
+// hashrate of every GPU and CPU thread over the last `seconds`, `last_counts` holds the counters of the last call
+static void output_worker_stats(time_t seconds, const stats_t& stats, std::vector<uint64_t>& last_counts) {
+    if (seconds <= 0) return;
+    char display[64];
+    for (size_t i = 0; i < stats.worker_count; i++) {
+        const uint64_t count = stats.workers[i].load();
+        format_hashrate(display, (double)(count - last_counts[i]) / (double)seconds);
+        last_counts[i] = count;
+        const bool gpu = i < stats.gpu_count;
+        printf("%s %2zu: %-12s%s", gpu ? "GPU" : "CPU", gpu ? i : i - stats.gpu_count, display,
+          (i % 6 == 5 || i + 1 == stats.worker_count) ? "\n" : "| ");
+    }
+}
+
+static void format_latency(char* display, uint64_t us) {
+    if (us >= 1000)
+        sprintf(display, "%.1fms", (double)us / 1000);
+    else
+        sprintf(display, "%luus", us);
+}
+
+// median, 99th percentile and largest job switch latency of every GPU and CPU thread since the start
+static void output_switch_latency(const stats_t& stats) {
+    char p50[32], p99[32], max[32];
+    size_t printed = 0;
+    for (size_t i = 0; i < stats.worker_count; i++) {
+        const switch_latency_t& latency = stats.switch_latency[i];
+        if (latency.total() == 0) continue;
+        if (printed == 0) printf("Job switch latency p50/p99/max:\n");
+        format_latency(p50, latency.quantile(0.5));
+        format_latency(p99, latency.quantile(0.99));
+        format_latency(max, latency.max_us.load(std::memory_order_relaxed));
+        const bool gpu = i < stats.gpu_count;
+        printf("%s%s %2zu: %s/%s/%s", printed % 4 == 0 ? "" : " | ", gpu ? "GPU" : "CPU", gpu ? i : i - stats.gpu_count,
+          p50, p99, max);
+        if (printed % 4 == 3) printf("\n");
+        printed++;
+    }
+    if (printed % 4 != 0) printf("\n");
+}
+
 static std::string seconds_to_uptime(int n) {
     int days = n / (24 * 3600);
 